@@ -0,0 +1,322 @@
+// Headless benchmark for the Tron engine (tron_game.hpp) and the bots' search (tron_bot.hpp).
+//
+// Plays whole matches without SFML or a server and reports throughput:
+//   scripted   players that go straight and turn aside before a wall or a trail, now and
+//              then at random, so the time is the engine's own
+//   territory  the bots' Voronoi count on positions taken from those matches
+//   bots       matches between tron_bot::Planner players with a fixed thinking budget
+//
+// --verify plays the scripted matches again next to a plain reference: an int grid with
+// the rules written out cell by cell, and the breadth-first territory search the bots
+// used before the bitboard one. Every tick the heads, every cell's owner, the occupancy
+// bits and the incremental hash are compared, and the territory counts every few ticks.
+// Exits with status 1 on the first difference.
+//
+// Usage: tron_bench [--matches N] [--players N] [--bot-matches N] [--think-ms N] [--seed N] [--verify]
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tron_bot.hpp"
+#include "tron_game.hpp"
+
+const int W = 60;
+const int H = 40;
+
+typedef std::chrono::steady_clock bench_clock;
+
+void report(const std::string& name, size_t ops, const std::string& unit, bench_clock::time_point start) {
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    std::cout << std::left << std::setw(12) << name
+              << std::right << std::setw(12) << ops << " " << std::left << std::setw(12) << unit
+              << std::right << std::setw(10) << std::fixed << std::setprecision(1) << seconds * 1e9 / ops << " ns each "
+              << std::setw(12) << std::setprecision(0) << ops / seconds << " /s" << std::endl;
+}
+
+// xorshift64*, cheap enough not to show next to a tick
+struct Random {
+    uint64_t state;
+
+    explicit Random(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+
+    uint32_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return static_cast<uint32_t>((state * 0x2545F4914F6CDD1DULL) >> 32);
+    }
+};
+
+bool free_ahead(const tron_game::Arena& arena, const tron_game::Player& p, int dir) {
+    int x = p.x + (dir == tron_game::RIGHT) - (dir == tron_game::LEFT);
+    int y = p.y + (dir == tron_game::DOWN) - (dir == tron_game::UP);
+    return arena.inside(x, y) && !arena.occupied(x, y);
+}
+
+// Straight on while the next cell is free, one time in 16 a random side anyway.
+// Returns the direction to turn to, or -1 to go on.
+int scripted_turn(const tron_game::Arena& arena, const tron_game::Player& p, Random& random) {
+    uint32_t r = random.next();
+    if (free_ahead(arena, p, p.dir) && (r & 15) != 0) {
+        return -1;
+    }
+    int side = (p.dir + ((r >> 4) & 1 ? 1 : 3)) % 4;
+    if (!free_ahead(arena, p, side)) {
+        side = (side + 2) % 4;
+    }
+    return free_ahead(arena, p, side) ? side : -1;
+}
+
+// The rules as the original single-file game had them, generalised to many players:
+// every head moves, one leaving the field or entering a trail crashes, and heads that
+// enter the same free cell all crash and leave it empty
+class ReferenceMatch {
+public:
+    void reset(const tron_game::Match& match) {
+        for (int x = 0; x < W; ++x) {
+            for (int y = 0; y < H; ++y) {
+                field[x][y] = match.arena.owner(x, y);
+            }
+        }
+        players = match.players;
+    }
+
+    void turn(int slot, int dir) {
+        tron_game::Player& p = players[slot];
+        if (p.alive && dir >= 0 && dir != (p.dir + 2) % 4) {
+            p.dir = dir;
+        }
+    }
+
+    void step() {
+        int entering[W][H] = {};
+        for (tron_game::Player& p : players) {
+            if (!p.alive) continue;
+            if (p.dir == tron_game::DOWN) p.y += 1;
+            if (p.dir == tron_game::LEFT) p.x -= 1;
+            if (p.dir == tron_game::UP) p.y -= 1;
+            if (p.dir == tron_game::RIGHT) p.x += 1;
+            if (p.x < 0 || p.x >= W || p.y < 0 || p.y >= H || field[p.x][p.y] != 0) {
+                p.alive = false;
+            } else {
+                entering[p.x][p.y]++;
+            }
+        }
+        for (size_t i = 0; i < players.size(); ++i) {
+            tron_game::Player& p = players[i];
+            if (!p.alive) continue;
+            if (entering[p.x][p.y] == 1) {
+                field[p.x][p.y] = static_cast<int>(i) + 1;
+            } else {
+                p.alive = false;
+            }
+        }
+    }
+
+    int field[W][H];
+    std::vector<tron_game::Player> players;
+};
+
+// Voronoi territory by breadth-first search from every head, as the bots counted it
+// before tron_bot::Territory
+void reference_territory(const tron_game::Match& match, int counts[tron_game::MAX_PLAYERS]) {
+    const int NEUTRAL = -2;
+    std::vector<int> owner(W * H, -1), distance(W * H, 0), queue;
+    std::fill(counts, counts + tron_game::MAX_PLAYERS, 0);
+    for (size_t i = 0; i < match.players.size(); ++i) {
+        const tron_game::Player& p = match.players[i];
+        if (!p.alive) continue;
+        owner[p.y * W + p.x] = static_cast<int>(i);
+        queue.push_back(p.y * W + p.x);
+    }
+    static const int dx[4] = {0, -1, 0, 1}, dy[4] = {1, 0, -1, 0};
+    for (size_t head = 0; head < queue.size(); ++head) {
+        int cell = queue[head], from = owner[cell];
+        for (int d = 0; d < 4; ++d) {
+            int nx = cell % W + dx[d], ny = cell / W + dy[d];
+            if (!match.arena.inside(nx, ny) || match.arena.occupied(nx, ny)) continue;
+            int next = ny * W + nx;
+            if (owner[next] == -1) {
+                owner[next] = from;
+                distance[next] = distance[cell] + 1;
+                queue.push_back(next);
+                if (from >= 0) {
+                    ++counts[from];
+                }
+            } else if (owner[next] != from && owner[next] >= 0 && distance[next] == distance[cell] + 1) {
+                --counts[owner[next]];
+                owner[next] = NEUTRAL;
+            }
+        }
+    }
+}
+
+// Empty string if match and reference agree, otherwise what differs
+std::string compare(const tron_game::Match& match, const ReferenceMatch& reference) {
+    for (size_t i = 0; i < match.players.size(); ++i) {
+        const tron_game::Player& a = match.players[i];
+        const tron_game::Player& b = reference.players[i];
+        if (a.alive != b.alive || (a.alive && (a.x != b.x || a.y != b.y || a.dir != b.dir))) {
+            return "player " + std::to_string(i + 1);
+        }
+    }
+    tron_game::Arena rebuilt(W, H);
+    int owned = 0;
+    for (int x = 0; x < W; ++x) {
+        for (int y = 0; y < H; ++y) {
+            int owner = reference.field[x][y];
+            if (match.arena.owner(x, y) != owner || match.arena.occupied(x, y) != (owner != 0)) {
+                return "cell " + std::to_string(x) + "," + std::to_string(y);
+            }
+            if (owner != 0) {
+                rebuilt.mark(x, y, owner);
+                ++owned;
+            }
+        }
+    }
+    if (match.arena.occupancy().count() != owned) {
+        return "occupancy count";
+    }
+    if (match.arena.hash() != rebuilt.hash()) {
+        return "arena hash";
+    }
+    return "";
+}
+
+int main(int argc, char* argv[]) {
+    int match_count = 20000;
+    int player_count = 2;
+    int bot_matches = 10;
+    int think_ms = 1;
+    uint64_t seed = 1;
+    bool verify = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--matches" && i + 1 < argc) {
+            match_count = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--players" && i + 1 < argc) {
+            player_count = std::min(tron_game::MAX_PLAYERS, std::max(2, std::atoi(argv[++i])));
+        } else if (arg == "--bot-matches" && i + 1 < argc) {
+            bot_matches = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--think-ms" && i + 1 < argc) {
+            think_ms = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--verify") {
+            verify = true;
+        }
+    }
+
+    std::cout << "Tron engine benchmark: " << W << "x" << H << " arena, " << player_count << " players" << std::endl;
+
+    // Scripted matches, keeping a few positions for the territory run
+    tron_game::Match match(W, H);
+    std::vector<tron_game::Match> positions;
+    Random random(seed);
+    size_t ticks = 0;
+    uint32_t digest = 0; // Keeps the matches from being optimised away
+    bench_clock::time_point start = bench_clock::now();
+    for (int m = 0; m < match_count; ++m) {
+        match.reset(player_count);
+        do {
+            for (size_t i = 0; i < match.players.size(); ++i) {
+                if (match.players[i].alive) {
+                    match.turn(static_cast<int>(i), scripted_turn(match.arena, match.players[i], random));
+                }
+            }
+            ++ticks;
+            if (positions.size() < 1000 && (random.next() & 63) == 0) {
+                positions.push_back(match);
+            }
+        } while (match.step());
+        digest ^= match.checksum();
+    }
+    report("scripted", ticks, "ticks", start);
+    report("", match_count, "matches", start);
+
+    if (!positions.empty()) {
+        tron_bot::Territory territory;
+        int counts[tron_game::MAX_PLAYERS];
+        size_t evaluations = 0;
+        start = bench_clock::now();
+        for (int round = 0; round < 100; ++round) {
+            for (const tron_game::Match& position : positions) {
+                territory.count(position, counts);
+                digest ^= static_cast<uint32_t>(counts[0]);
+                ++evaluations;
+            }
+        }
+        report("territory", evaluations, "counts", start);
+    }
+
+    if (bot_matches > 0) {
+        tron_bot::Planner planner;
+        size_t bot_ticks = 0, bot_evaluations = 0;
+        start = bench_clock::now();
+        for (int m = 0; m < bot_matches; ++m) {
+            match.reset(player_count);
+            do {
+                for (int slot = 0; slot < player_count; ++slot) {
+                    if (match.players[slot].alive) {
+                        int dir = planner.choose(match, slot, bench_clock::now() + std::chrono::milliseconds(think_ms));
+                        bot_evaluations += planner.evaluation_count();
+                        match.turn(slot, dir);
+                    }
+                }
+                ++bot_ticks;
+            } while (match.step());
+            digest ^= match.checksum();
+        }
+        report("bots", bot_ticks, "ticks", start);
+        std::cout << "            " << bot_evaluations / std::max<size_t>(1, bot_ticks * player_count)
+                  << " positions searched per decision, " << think_ms << " ms budget" << std::endl;
+    }
+    std::cout << "digest " << std::hex << digest << std::dec << std::endl;
+
+    if (!verify) {
+        return 0;
+    }
+    random = Random(seed);
+    ReferenceMatch reference;
+    size_t checked = 0, territory_checks = 0;
+    for (int m = 0; m < match_count; ++m) {
+        match.reset(player_count);
+        reference.reset(match);
+        bool running = true;
+        uint32_t tick = 0;
+        while (running) {
+            for (size_t i = 0; i < match.players.size(); ++i) {
+                if (match.players[i].alive) {
+                    int dir = scripted_turn(match.arena, match.players[i], random);
+                    match.turn(static_cast<int>(i), dir);
+                    reference.turn(static_cast<int>(i), dir);
+                }
+            }
+            running = match.step();
+            reference.step();
+            ++tick;
+            std::string difference = compare(match, reference);
+            if (difference.empty() && tick % 8 == 0) {
+                tron_bot::Territory territory;
+                int counts[tron_game::MAX_PLAYERS], expected[tron_game::MAX_PLAYERS];
+                territory.count(match, counts);
+                reference_territory(match, expected);
+                if (!std::equal(counts, counts + tron_game::MAX_PLAYERS, expected)) {
+                    difference = "territory";
+                }
+                ++territory_checks;
+            }
+            if (!difference.empty()) {
+                std::cout << "verify: match " << m << " tick " << tick << ": " << difference << " differs" << std::endl;
+                return 1;
+            }
+            ++checked;
+        }
+    }
+    std::cout << "verify: " << checked << " ticks and " << territory_checks << " territory counts match the reference" << std::endl;
+    return 0;
+}
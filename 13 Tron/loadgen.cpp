@@ -0,0 +1,453 @@
+// Headless load generator for tron_server.
+//
+// Opens groups of --room-size websocket connections (2 by default) against a local
+// tron_server. In each group the first connection creates a room, the others join it,
+// and the creator starts the game again and again while all of them send INPUT turns. With --quick-match every connection
+// queues for QUICK_MATCH instead and queues again after each game, which keeps the
+// server's matcher busy. --spectators N adds N connections watching each created room.
+// --lockstep makes the created rooms lockstep rooms, which send STEP instead of state.
+// Every connection also sends PING and times the PONG. Prints the connect rate, message
+// rates and round-trip percentiles.
+//
+// Usage: tron_loadgen [--uri ws://localhost:9002] [--connections N] [--duration S]
+//                     [--connect-rate N/s] [--input-ms N] [--ping-ms N] [--threads N] [--binary]
+//                     [--room-size N] [--lockstep] [--quick-match | --spectators N]
+//
+// Thousands of connections need a raised open-file limit (ulimit -n).
+
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tron_protocol.hpp"
+
+typedef websocketpp::client<websocketpp::config::asio_client> client;
+typedef websocketpp::config::asio_client::message_type::ptr message_ptr;
+typedef websocketpp::connection_hdl connection_hdl;
+typedef websocketpp::lib::asio::steady_timer steady_timer;
+typedef std::chrono::steady_clock load_clock;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+using websocketpp::lib::bind;
+
+struct Options {
+    std::string uri = "ws://localhost:9002";
+    int connections = 1000;
+    int duration_s = 30;
+    int connect_rate = 0; // Connections opened per second, 0 = all at once
+    int input_ms = 200;
+    int ping_ms = 500;
+    int threads = 1;
+    bool binary = false;
+    bool quick_match = false;
+    int spectators = 0;   // Watchers per created room
+    int room_size = 2;    // Players per created room
+    bool lockstep = false; // Created rooms run in lockstep mode
+};
+
+// One scripted player. Handlers of a connection and the load timer both touch it, so
+// everything mutable is behind mtx.
+struct Bot {
+    int index;
+    bool creator;          // First connection of a group, creates the room and starts games
+    int slot = -1;         // Seat in the current quick match
+    bool spectator = false; // Watches the room of partner instead of playing
+    Bot* partner = nullptr; // Creator of the room, for joiners and spectators
+    std::vector<Bot*> joiners;  // Players of a creator's room
+    std::vector<Bot*> watchers; // Spectators of a creator's room
+    std::mutex mtx;
+    client::connection_ptr con;
+    bool open = false;
+    bool in_game = false;
+    std::string room_id;
+    uint64_t ping_seq = 0;
+    bool ping_pending = false;
+    load_clock::time_point ping_sent;
+    std::vector<uint32_t> rtt_us;
+};
+
+Options options;
+client endpoint;
+std::vector<std::unique_ptr<Bot>> bots;
+
+std::atomic<uint64_t> connects{0};
+std::atomic<uint64_t> failures{0};
+std::atomic<uint64_t> messages_out{0};
+std::atomic<uint64_t> messages_in{0};
+std::atomic<uint64_t> bytes_out{0};
+std::atomic<uint64_t> bytes_in{0};
+std::atomic<uint64_t> games_started{0};
+std::atomic<uint64_t> games_finished{0};
+load_clock::time_point run_start;
+std::atomic<int64_t> last_connect_us{0};
+
+void send_text(Bot& bot, const std::string& msg) {
+    if (!bot.con) {
+        return;
+    }
+    websocketpp::lib::error_code ec = bot.con->send(msg, websocketpp::frame::opcode::text);
+    if (!ec) {
+        messages_out.fetch_add(1, std::memory_order_relaxed);
+        bytes_out.fetch_add(msg.size(), std::memory_order_relaxed);
+    }
+}
+
+// Called with bot.mtx held on the joiner or spectator once both the room id and its
+// connection exist
+void join_if_ready(Bot& joiner) {
+    if (joiner.open && !joiner.room_id.empty()) {
+        send_text(joiner, (joiner.spectator ? "SPECTATE " : "JOIN_ROOM ") + joiner.room_id);
+    }
+}
+
+// Called with creator.mtx held once its room is ready for the joiners and spectators
+void invite(Bot& creator) {
+    for (Bot* joiner : creator.joiners) {
+        std::lock_guard<std::mutex> joiner_lock(joiner->mtx);
+        joiner->room_id = creator.room_id;
+        join_if_ready(*joiner);
+    }
+    for (Bot* watcher : creator.watchers) {
+        std::lock_guard<std::mutex> watcher_lock(watcher->mtx);
+        watcher->room_id = creator.room_id;
+        join_if_ready(*watcher);
+    }
+}
+
+void on_open(Bot* bot, connection_hdl) {
+    int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(load_clock::now() - run_start).count();
+    connects.fetch_add(1, std::memory_order_relaxed);
+    last_connect_us.store(now_us, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(bot->mtx);
+    bot->open = true;
+    if (options.quick_match) {
+        send_text(*bot, "QUICK_MATCH");
+    } else if (bot->creator) {
+        send_text(*bot, "CREATE_ROOM loadgen-" + std::to_string(bot->index));
+    } else {
+        join_if_ready(*bot);
+    }
+}
+
+void on_fail(Bot* bot, connection_hdl) {
+    failures.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(bot->mtx);
+    bot->con.reset();
+}
+
+void on_close(Bot* bot, connection_hdl) {
+    std::lock_guard<std::mutex> lock(bot->mtx);
+    bot->open = false;
+    bot->in_game = false;
+}
+
+void on_message(Bot* bot, connection_hdl, message_ptr msg) {
+    messages_in.fetch_add(1, std::memory_order_relaxed);
+    bytes_in.fetch_add(msg->get_payload().size(), std::memory_order_relaxed);
+    if (msg->get_opcode() == websocketpp::frame::opcode::binary) {
+        return; // State frames, only counted
+    }
+
+    std::stringstream ss(msg->get_payload());
+    std::string command;
+    ss >> command;
+    if (command == "TICK" || command == "KEYFRAME" || command == "STEP") {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(bot->mtx);
+    if (command == "PONG") {
+        uint64_t seq = 0;
+        ss >> seq;
+        if (bot->ping_pending && seq == bot->ping_seq) {
+            auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(load_clock::now() - bot->ping_sent);
+            bot->rtt_us.push_back(static_cast<uint32_t>(rtt.count()));
+            bot->ping_pending = false;
+        }
+    } else if (command == "ROOM_CREATED") {
+        ss >> bot->room_id;
+        if (options.lockstep) {
+            send_text(*bot, "SET_ROOM mode lockstep");
+        }
+        if (options.room_size != 2) {
+            // The others join once the room has grown, see ROOM_UPDATE
+            send_text(*bot, "SET_ROOM players " + std::to_string(options.room_size));
+            return;
+        }
+        invite(*bot);
+    } else if (command == "ROOM_UPDATE") {
+        std::string room_id;
+        int players = 0, max_players = 0;
+        ss >> room_id >> players >> max_players;
+        if (options.quick_match || !bot->creator || bot->in_game) {
+            return;
+        }
+        if (options.room_size != 2 && players == 1 && max_players == options.room_size) {
+            invite(*bot);
+        } else if (players == max_players) {
+            send_text(*bot, "START_GAME " + bot->room_id);
+        }
+    } else if (command == "MATCH_FOUND") {
+        ss >> bot->room_id >> bot->slot;
+    } else if (command == "GAME_START") {
+        bot->in_game = !bot->spectator;
+        if (options.quick_match ? bot->slot == 0 : bot->creator) {
+            games_started.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else if (command == "GAME_OVER") {
+        bot->in_game = false;
+        if (options.quick_match) {
+            if (bot->slot == 0) {
+                games_finished.fetch_add(1, std::memory_order_relaxed);
+            }
+            send_text(*bot, "LEAVE_ROOM " + bot->room_id);
+            send_text(*bot, "QUICK_MATCH");
+        } else if (bot->creator) {
+            games_finished.fetch_add(1, std::memory_order_relaxed);
+            send_text(*bot, "START_GAME " + bot->room_id);
+        }
+    }
+}
+
+void connect_bot(Bot& bot) {
+    websocketpp::lib::error_code ec;
+    client::connection_ptr con = endpoint.get_connection(options.uri, ec);
+    if (ec) {
+        failures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (options.binary) {
+        con->add_subprotocol(tron_protocol::SUBPROTOCOL, ec);
+    }
+    con->set_open_handler(bind(&on_open, &bot, ::_1));
+    con->set_fail_handler(bind(&on_fail, &bot, ::_1));
+    con->set_close_handler(bind(&on_close, &bot, ::_1));
+    con->set_message_handler(bind(&on_message, &bot, ::_1, ::_2));
+    {
+        std::lock_guard<std::mutex> lock(bot.mtx);
+        bot.con = con;
+    }
+    endpoint.connect(con);
+}
+
+// Drives connects, turns and pings. Runs every 10 ms on the client io_service.
+void on_load_timer(std::shared_ptr<steady_timer> timer, size_t next_connect, load_clock::time_point next_input,
+                   load_clock::time_point next_ping, websocketpp::lib::asio::error_code const & ec) {
+    if (ec) {
+        return;
+    }
+    thread_local std::mt19937 generator(std::random_device{}());
+    load_clock::time_point now = load_clock::now();
+
+    // Open connections at the requested rate
+    double elapsed = std::chrono::duration<double>(now - run_start).count();
+    size_t due = options.connect_rate > 0
+        ? std::min(bots.size(), static_cast<size_t>(elapsed * options.connect_rate) + 1)
+        : bots.size();
+    for (; next_connect < due; ++next_connect) {
+        connect_bot(*bots[next_connect]);
+    }
+
+    bool send_inputs = now >= next_input;
+    bool send_pings = now >= next_ping;
+    if (send_inputs) {
+        next_input = now + std::chrono::milliseconds(options.input_ms);
+    }
+    if (send_pings) {
+        next_ping = now + std::chrono::milliseconds(options.ping_ms);
+    }
+    if (send_inputs || send_pings) {
+        std::uniform_int_distribution<int> turn(0, 3);
+        for (auto& bot : bots) {
+            std::lock_guard<std::mutex> lock(bot->mtx);
+            if (!bot->open) {
+                continue;
+            }
+            if (send_inputs && bot->in_game) {
+                send_text(*bot, "INPUT " + std::to_string(turn(generator)));
+            }
+            if (send_pings && !bot->ping_pending) {
+                bot->ping_pending = true;
+                bot->ping_sent = now;
+                send_text(*bot, "PING " + std::to_string(++bot->ping_seq));
+            }
+        }
+    }
+
+    timer->expires_at(now + std::chrono::milliseconds(10));
+    timer->async_wait(bind(&on_load_timer, timer, next_connect, next_input, next_ping, ::_1));
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// The generator only ever targets the local machine
+bool is_local_uri(const std::string& uri) {
+    const std::string prefixes[] = {"ws://localhost", "ws://127.0.0.1", "ws://[::1]"};
+    for (const std::string& prefix : prefixes) {
+        if (uri.compare(0, prefix.size(), prefix) == 0 &&
+            (uri.size() == prefix.size() || uri[prefix.size()] == ':' || uri[prefix.size()] == '/')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--uri" && i + 1 < argc) {
+            options.uri = argv[++i];
+        } else if (arg == "--connections" && i + 1 < argc) {
+            options.connections = std::max(2, std::atoi(argv[++i]));
+        } else if (arg == "--duration" && i + 1 < argc) {
+            options.duration_s = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--connect-rate" && i + 1 < argc) {
+            options.connect_rate = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--input-ms" && i + 1 < argc) {
+            options.input_ms = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--ping-ms" && i + 1 < argc) {
+            options.ping_ms = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--binary") {
+            options.binary = true;
+        } else if (arg == "--lockstep") {
+            options.lockstep = true;
+        } else if (arg == "--quick-match") {
+            options.quick_match = true;
+        } else if (arg == "--room-size" && i + 1 < argc) {
+            options.room_size = std::min(16, std::max(2, std::atoi(argv[++i])));
+        } else if (arg == "--spectators" && i + 1 < argc) {
+            options.spectators = std::max(0, std::atoi(argv[++i]));
+        } else {
+            std::cout << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (!is_local_uri(options.uri)) {
+        std::cout << "tron_loadgen only runs against localhost, refusing " << options.uri << std::endl;
+        return 1;
+    }
+
+    // Groups of a creator and its joiners
+    if (options.quick_match) {
+        options.room_size = 2;  // The matcher pairs players
+        options.spectators = 0; // Quick-match rooms are only known to their players
+    }
+    int group = options.room_size;
+    options.connections = std::max(group, options.connections - options.connections % group);
+    for (int i = 0; i < options.connections; ++i) {
+        bots.emplace_back(new Bot());
+        bots.back()->index = i;
+        bots.back()->creator = (i % group == 0);
+    }
+    for (int i = 0; i < options.connections; i += group) {
+        for (int j = i + 1; j < i + group; ++j) {
+            bots[i]->joiners.push_back(bots[j].get());
+            bots[j]->partner = bots[i].get();
+        }
+    }
+    for (int i = 0; i < options.connections; i += group) {
+        for (int w = 0; w < options.spectators; ++w) {
+            bots.emplace_back(new Bot());
+            Bot* watcher = bots.back().get();
+            watcher->index = static_cast<int>(bots.size()) - 1;
+            watcher->creator = false;
+            watcher->spectator = true;
+            watcher->partner = bots[i].get();
+            bots[i]->watchers.push_back(watcher);
+        }
+    }
+
+    endpoint.clear_access_channels(websocketpp::log::alevel::all);
+    endpoint.clear_error_channels(websocketpp::log::elevel::all);
+    endpoint.init_asio();
+    endpoint.start_perpetual();
+
+    std::cout << "Load test against " << options.uri << ": " << bots.size() << " connections, "
+              << options.duration_s << " s" << (options.binary ? ", binary frames" : "")
+              << (options.quick_match ? ", quick match" : "") << (options.lockstep ? ", lockstep" : "") << std::endl;
+
+    run_start = load_clock::now();
+    auto timer = std::make_shared<steady_timer>(endpoint.get_io_service());
+    timer->expires_at(run_start);
+    timer->async_wait(bind(&on_load_timer, timer, size_t(0), run_start, run_start, ::_1));
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < options.threads; ++i) {
+        pool.emplace_back([]() { endpoint.run(); });
+    }
+
+    // Print progress once per second
+    uint64_t last_in = 0, last_out = 0;
+    for (int second = 1; second <= options.duration_s; ++second) {
+        std::this_thread::sleep_until(run_start + std::chrono::seconds(second));
+        uint64_t in = messages_in.load(), out = messages_out.load();
+        std::cout << "[" << std::setw(3) << second << "s] connected " << connects.load()
+                  << "  failed " << failures.load()
+                  << "  msg/s in " << (in - last_in) << " out " << (out - last_out)
+                  << "  games " << games_finished.load() << "/" << games_started.load() << std::endl;
+        last_in = in;
+        last_out = out;
+    }
+    double run_seconds = std::chrono::duration<double>(load_clock::now() - run_start).count();
+
+    // Shut everything down
+    timer->cancel();
+    endpoint.stop_perpetual();
+    for (auto& bot : bots) {
+        std::lock_guard<std::mutex> lock(bot->mtx);
+        if (bot->con && bot->open) {
+            websocketpp::lib::error_code ec;
+            bot->con->close(websocketpp::close::status::going_away, "", ec);
+        }
+    }
+    std::thread stopper([]() {
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+        endpoint.stop();
+    });
+    for (std::thread& t : pool) {
+        t.join();
+    }
+    stopper.join();
+
+    std::vector<uint32_t> rtt;
+    for (auto& bot : bots) {
+        rtt.insert(rtt.end(), bot->rtt_us.begin(), bot->rtt_us.end());
+    }
+    std::sort(rtt.begin(), rtt.end());
+
+    double connect_seconds = last_connect_us.load() / 1e6;
+    std::cout << std::fixed << std::setprecision(1) << std::endl
+              << "connections     " << connects.load() << " ok, " << failures.load() << " failed" << std::endl
+              << "connect rate    " << (connect_seconds > 0 ? connects.load() / connect_seconds : 0.0) << " /s" << std::endl
+              << "messages out    " << messages_out.load() / run_seconds << " /s (" << bytes_out.load() / run_seconds / 1024 << " KiB/s)" << std::endl
+              << "messages in     " << messages_in.load() / run_seconds << " /s (" << bytes_in.load() / run_seconds / 1024 << " KiB/s)" << std::endl
+              << "games           " << games_finished.load() << " finished of " << games_started.load() << " started" << std::endl
+              << "ping rtt (us)   n=" << rtt.size() << "  p50 " << percentile(rtt, 0.50)
+              << "  p99 " << percentile(rtt, 0.99) << "  p999 " << percentile(rtt, 0.999)
+              << "  max " << (rtt.empty() ? 0 : rtt.back()) << std::endl;
+    return 0;
+}
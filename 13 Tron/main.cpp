@@ -3,14 +3,20 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <atomic>
+#include <chrono>
 #include <thread>
-#include <mutex>
-#include <queue>
+#include <map>
 #include <sstream> // For std::stringstream
 
 #include <websocketpp/client.hpp>
 #include <websocketpp/config/asio_no_tls_client.hpp>
 
+#include "tron_game.hpp"
+#include "tron_playout.hpp"
+#include "tron_protocol.hpp"
+#include "tron_queue.hpp"
+
 using namespace sf;
 
 using websocketpp::lib::placeholders::_1;
@@ -24,31 +30,189 @@ typedef websocketpp::config::asio_client::message_type::ptr message_ptr;
 // GameState enum
 enum GameState { MainMenu, Playing, GameOver, Instructions, MultiplayerMenu };
 
-// Player struct
-struct Player {
-    int x, y, dir;
-    Color color;
+// The websocket client lives on one network thread, started with the window and kept
+// for the whole session; the render thread never touches it. The two threads talk through
+// a pair of single-producer single-consumer rings: commands go out on one, connection
+// events and server messages come back on the other, and the render thread drains that
+// once per frame without ever waiting on the network.
+struct NetCommand {
+    enum Kind { Connect, Send, Close, Stop } kind;
+    std::string text; // URI to connect to, or message to send
+};
+
+// Connection event or message from the server, binary ones carry tron_protocol frames
+struct NetEvent {
+    enum Kind { Opened, Closed, Failed, Message } kind;
+    websocketpp::frame::opcode::value opcode;
+    std::string payload;
+    double received_ms = 0; // steadyMs() when the network thread got it
 };
 
+// Milliseconds on the steady clock, which times server ticks from their arrival to their playout
+double steadyMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 // Global variables
 const int W = 60;
 const int H = 40;
 const int ts = 18; // tile size
 
-Player p1, p2;
-int field[W][H] = {0};
+tron_game::Match game(W, H);
+// Trail color of each player slot
+const Color playerColors[tron_game::MAX_PLAYERS] = {
+    Color::Red, Color::Blue, Color::Green, Color::Yellow, Color::Magenta, Color::Cyan, Color::White,
+    Color(255, 128, 0), Color(128, 0, 255), Color(0, 255, 128), Color(255, 0, 128), Color(128, 255, 0),
+    Color(0, 128, 255), Color(255, 192, 203), Color(160, 82, 45), Color(128, 128, 128)
+};
+
+// Trails as one vertex array with a quad per owned cell, drawn in a single call. Cells
+// only change under the heads, so after a tick sync() looks at one cell per player and
+// appends a quad for each newly owned one; rebuild() walks the whole arena and is left
+// for resets and keyframes, which replace it.
+class TrailMesh : public Drawable {
+public:
+    void rebuild(const tron_game::Arena& arena) {
+        vertices.clear();
+        quads.assign(static_cast<size_t>(W) * H, -1);
+        owners.assign(static_cast<size_t>(W) * H, 0);
+        for (int y = 0; y < H; y++) {
+            for (int x = 0; x < W; x++) {
+                set(x, y, arena.owner(x, y));
+            }
+        }
+    }
+
+    void syncCell(const tron_game::Arena& arena, int x, int y) {
+        set(x, y, arena.owner(x, y));
+    }
+
+    void sync(const tron_game::Match& match) {
+        for (const tron_game::Player& p : match.players) {
+            if (match.arena.inside(p.x, p.y)) {
+                set(p.x, p.y, match.arena.owner(p.x, p.y));
+            }
+        }
+    }
+
+private:
+    void set(int x, int y, int owner) {
+        size_t cell = static_cast<size_t>(y) * W + x;
+        if (owners[cell] == owner) {
+            return;
+        }
+        owners[cell] = static_cast<uint8_t>(owner);
+        if (quads[cell] < 0) {
+            quads[cell] = static_cast<int>(vertices.getVertexCount());
+            vertices.append(Vertex(Vector2f(x * ts, y * ts)));
+            vertices.append(Vertex(Vector2f((x + 1) * ts, y * ts)));
+            vertices.append(Vertex(Vector2f((x + 1) * ts, (y + 1) * ts)));
+            vertices.append(Vertex(Vector2f(x * ts, (y + 1) * ts)));
+        }
+        // A cell emptied again (head-on crash) keeps its quad, transparent
+        Color color = owner == 0 ? Color::Transparent : playerColors[(owner - 1) % tron_game::MAX_PLAYERS];
+        for (int corner = 0; corner < 4; corner++) {
+            vertices[quads[cell] + corner].color = color;
+        }
+    }
+
+    void draw(RenderTarget& target, RenderStates states) const override {
+        target.draw(vertices, states);
+    }
+
+    VertexArray vertices{Quads};
+    std::vector<int> quads;      // First vertex of each cell's quad, -1 if it has none
+    std::vector<uint8_t> owners; // Owner each cell is drawn with
+};
+TrailMesh trails;
+
 GameState gameState = MainMenu;
 String winner;
 bool isOnline = false; // To distinguish between local and online game
 
 // WebSocket Client global variables
-client c;
-websocketpp::connection_hdl hdl;
-std::mutex mtx;
-std::queue<std::string> message_queue;
-bool is_connected = false;
+client c;                           // Network thread only, once it runs
+tron_queue::SpscRing<NetCommand> net_commands(1024);
+tron_queue::SpscRing<NetEvent> net_events(8192);
+std::atomic<bool> net_wake_pending(false); // A drain of net_commands is posted to the network thread
+std::atomic<bool> net_events_lost(false);  // net_events was full, the render thread resyncs
+bool is_connected = false;          // Render thread's view, from the Opened and Closed events
 std::string currentRoomId = ""; // To store the ID of the room the player is in
 bool isRoomCreator = false; // To know if the player created the room
+int mySlot = -1; // Player slot in the running online match, -1 when watching
+int roomMaxPlayers = 2; // Room size from ROOM_UPDATE, the creator changes it with SET_ROOM
+bool roomLockstep = false; // Room mode from ROOM_UPDATE, the creator changes it with SET_ROOM
+bool awaitingKeyframe = false; // Lockstep match out of step, STEP ticks wait for the RESYNC keyframe
+bool isSearchingMatch = false; // Waiting in the server's quick-match queue
+bool isSpectating = false; // Watching a room instead of playing in it
+uint32_t lastServerTick = 0; // Latest tick applied from TICK or a state frame
+uint32_t newestServerTick = 0; // Latest tick received, turns we do not predict are tagged with the next one
+int serverTickMs = 50; // Match tick interval from GAME_START
+
+// Prediction, for our own cycle in state rooms: the match on screen runs ahead of the
+// server's ticks on our own clock, with our turns applied as we make them and everyone
+// else going straight. Ticks we predicted are kept, and the server's tick is compared with
+// ours when it arrives; if they differ, the predicted ticks are taken back and played
+// again from the server's heads.
+const uint32_t PREDICT_LIMIT = 4;    // Ticks we run ahead of the server at most, its rewind window
+const uint32_t PREDICT_HISTORY = 64; // Power of two, well over PREDICT_LIMIT
+struct PredictedTick {
+    tron_game::Player players[tron_game::MAX_PLAYERS];
+};
+struct SentTurn {
+    uint32_t tick = 0; // The turn belongs to tick only while this is tick
+    int dir = -1;
+};
+PredictedTick predictedTicks[PREDICT_HISTORY]; // Heads after each tick, by tick % PREDICT_HISTORY
+SentTurn sentTurns[PREDICT_HISTORY];           // Our turns, by the tick they were tagged with
+uint32_t predictedTick = 0;                    // Tick on screen
+float predictTimer = 0;                        // Seconds towards the next predicted tick
+
+// Playout, for matches we watch or run in lockstep: their ticks wait in a jitter buffer
+// and are applied on a steady clock a little behind the newest, instead of the moment
+// they arrive, and the heads are drawn gliding from the tick on screen toward the next
+// one. Predicted matches go without, our own clock paces them already.
+tron_playout::PlayoutBuffer<tron_protocol::Frame> playout;
+std::string resumeToken = ""; // From RESUME_TOKEN, gets our seat back after a dropped connection
+bool resumePending = false; // Connection dropped while seated, reconnect and send RESUME
+float reconnectTimer = 0; // Seconds since the last reconnect attempt
+
+// Room directory kept up to date from LIST_ROOMS and the LOBBY_* updates, by room id
+struct LobbyRoom {
+    int players, max_players;
+    std::string state; // open, full or started
+    std::string name;
+};
+std::map<std::string, LobbyRoom> lobbyRooms;
+const int lobbyListX = W * ts - 330;
+const int lobbyListY = 190;
+const int lobbyRowHeight = 30;
+const int lobbyMaxRows = 12;
+
+// The lobby list shows rooms to join and running matches to watch
+bool isListed(const LobbyRoom& room) {
+    return room.state == "open" || room.state == "started";
+}
+
+// Apply one LOBBY_ADD, LOBBY_UPDATE or LOBBY_REMOVE line to lobbyRooms
+void applyLobbyDiff(const std::string& line) {
+    std::stringstream ss(line);
+    std::string command, r_id;
+    ss >> command >> r_id;
+    if (command == "LOBBY_ADD") {
+        LobbyRoom room;
+        ss >> room.players >> room.max_players >> room.state;
+        std::getline(ss >> std::ws, room.name);
+        lobbyRooms[r_id] = room;
+    } else if (command == "LOBBY_UPDATE") {
+        auto it = lobbyRooms.find(r_id);
+        if (it != lobbyRooms.end()) {
+            ss >> it->second.players >> it->second.max_players >> it->second.state;
+        }
+    } else if (command == "LOBBY_REMOVE") {
+        lobbyRooms.erase(r_id);
+    }
+}
 
 // Global variables for text input
 std::string roomNameString = "";
@@ -56,134 +220,491 @@ std::string roomIdInputString = ""; // Changed from roomIdString to avoid confli
 bool isRoomNameInputActive = false;
 bool isRoomIdInputActive = false;
 
-// WebSocket Callbacks
+// Network thread state
+websocketpp::connection_hdl hdl;
+enum { NetIdle, NetConnecting, NetOpen } net_state = NetIdle;
+std::vector<std::string> net_unsent; // Sent while connecting, goes out once open
+
+// Hand an event to the render thread. A full ring drops it and has the render thread
+// ask for fresh state instead of stalling the connection.
+void post_event(NetEvent event) {
+    if (!net_events.try_push(std::move(event))) {
+        net_events_lost.store(true);
+    }
+}
+
+// WebSocket Callbacks, on the network thread
 void on_open(client* c, websocketpp::connection_hdl new_hdl) {
-    std::cout << "Connected to server!" << std::endl;
     hdl = new_hdl;
-    is_connected = true;
+    net_state = NetOpen;
+    for (const std::string& msg : net_unsent) {
+        websocketpp::lib::error_code ec;
+        c->send(hdl, msg, websocketpp::frame::opcode::text, ec);
+    }
+    net_unsent.clear();
+    post_event({NetEvent::Opened, websocketpp::frame::opcode::text, ""});
 }
 
 void on_fail(client* c, websocketpp::connection_hdl new_hdl) {
-    std::cout << "Connection failed!" << std::endl;
-    is_connected = false;
-    currentRoomId = "";
-    isRoomCreator = false;
+    net_state = NetIdle;
+    net_unsent.clear();
+    post_event({NetEvent::Failed, websocketpp::frame::opcode::text, ""});
 }
 
 void on_message(client* c, websocketpp::connection_hdl hdl, message_ptr msg) {
-    std::lock_guard<std::mutex> lock(mtx);
-    message_queue.push(msg->get_payload());
+    post_event({NetEvent::Message, msg->get_opcode(), msg->get_payload(), steadyMs()});
 }
 
 void on_close(client* c, websocketpp::connection_hdl new_hdl) {
+    net_state = NetIdle;
+    net_unsent.clear();
+    post_event({NetEvent::Closed, websocketpp::frame::opcode::text, ""});
+}
+
+// Carry out the render thread's commands, posted to the network thread by net_command
+void drain_commands() {
+    net_wake_pending.store(false);
+    NetCommand command;
+    while (net_commands.try_pop(command)) {
+        websocketpp::lib::error_code ec;
+        if (command.kind == NetCommand::Connect && net_state == NetIdle) {
+            client::connection_ptr con = c.get_connection(command.text, ec);
+            if (ec) {
+                std::cout << "Could not create connection because: " << ec.message() << std::endl;
+                post_event({NetEvent::Failed, websocketpp::frame::opcode::text, ""});
+                continue;
+            }
+            // Offer the binary state protocol, the server falls back to text if it does not select it
+            con->add_subprotocol(tron_protocol::SUBPROTOCOL);
+            hdl = con->get_handle();
+            net_state = NetConnecting;
+            c.connect(con);
+        } else if (command.kind == NetCommand::Send) {
+            if (net_state == NetOpen) {
+                c.send(hdl, command.text, websocketpp::frame::opcode::text, ec);
+                if (ec) {
+                    std::cout << "Error sending message: " << ec.message() << std::endl;
+                }
+            } else if (net_state == NetConnecting) {
+                net_unsent.push_back(command.text);
+            } else {
+                std::cout << "Not connected to send message." << std::endl;
+            }
+        } else if (command.kind == NetCommand::Close || command.kind == NetCommand::Stop) {
+            if (net_state != NetIdle) {
+                c.close(hdl, websocketpp::close::status::going_away, "", ec);
+            }
+            if (command.kind == NetCommand::Stop) {
+                c.stop_perpetual(); // run() returns once the close handshake is done
+            }
+        }
+    }
+}
+
+// Set up the client and start the network thread, which runs its io_service until Stop
+std::thread start_network() {
+    // Set logging to be pretty verbose (everything except message payloads)
+    c.set_access_channels(websocketpp::log::alevel::all);
+    c.clear_access_channels(websocketpp::log::alevel::frame_payload);
+
+    c.init_asio();
+    c.set_open_handler(bind(&on_open, &c, ::_1));
+    c.set_fail_handler(bind(&on_fail, &c, ::_1));
+    c.set_message_handler(bind(&on_message, &c, ::_1, ::_2));
+    c.set_close_handler(bind(&on_close, &c, ::_1));
+    c.start_perpetual();
+    return std::thread([]() {
+        try {
+            c.run();
+        } catch (websocketpp::exception const & e) {
+            std::cout << e.what() << std::endl;
+        }
+    });
+}
+
+// Queue a command for the network thread and wake it, unless a wakeup is pending already
+void net_command(NetCommand command) {
+    if (!net_commands.try_push(std::move(command))) {
+        std::cout << "Network queue full, command dropped." << std::endl;
+        return;
+    }
+    if (!net_wake_pending.exchange(true)) {
+        c.get_io_service().post(&drain_commands);
+    }
+}
+
+// Connect to the WebSocket server, unless connected or connecting already
+void connect_websocket(const std::string& uri) {
+    net_command({NetCommand::Connect, uri});
+}
+
+// Send a message via WebSocket; one sent while connecting goes out once connected
+void send_websocket_message(const std::string& msg) {
+    net_command({NetCommand::Send, msg});
+}
+
+void close_websocket() {
+    net_command({NetCommand::Close, ""});
+}
+
+// Connection events, on the render thread
+void handleOpen() {
+    std::cout << "Connected to server!" << std::endl;
+    is_connected = true;
+    lobbyRooms.clear();
+
+    // Follow the room directory; subscribing first means no change is missed before the list arrives
+    send_websocket_message("SUBSCRIBE_LOBBY");
+    send_websocket_message("LIST_ROOMS all - 100");
+    if (resumePending) {
+        send_websocket_message("RESUME " + resumeToken);
+    }
+}
+
+void handleFail() {
+    std::cout << "Connection failed!" << std::endl;
+    is_connected = false;
+    if (resumePending) {
+        return; // The main loop tries again while the server still holds our seat
+    }
+    currentRoomId = "";
+    isRoomCreator = false;
+    isSearchingMatch = false;
+    isSpectating = false;
+}
+
+void handleClose() {
     std::cout << "Disconnected from server!" << std::endl;
     is_connected = false;
+    // Dropped while seated in a room: keep the room and match on screen and reconnect
+    if (!currentRoomId.empty() && !isSpectating && !resumeToken.empty()) {
+        resumePending = true;
+        reconnectTimer = 0;
+        return;
+    }
     currentRoomId = "";
     isRoomCreator = false;
+    isSearchingMatch = false;
+    isSpectating = false;
+    lobbyRooms.clear();
 }
 
-// Function to connect to WebSocket server
-void connect_websocket(const std::string& uri) {
-    try {
-        // Set logging to be pretty verbose (everything except message payloads)
-        c.set_access_channels(websocketpp::log::alevel::all);
-        c.clear_access_channels(websocketpp::log::alevel::frame_payload);
+void savePredicted(uint32_t tick) {
+    std::copy(game.players.begin(), game.players.end(), predictedTicks[tick % PREDICT_HISTORY].players);
+}
 
-        // Initialize ASIO
-        c.init_asio();
+// Start a match of the given number of players on an empty arena
+void resetGame(int players = 2) {
+    game.reset(players);
+    trails.rebuild(game.arena);
+    std::fill(std::begin(sentTurns), std::end(sentTurns), SentTurn());
+    predictedTick = 0;
+    predictTimer = 0;
+    savePredicted(0);
+    newestServerTick = 0;
+    playout.reset(serverTickMs);
+}
 
-        // Register our handlers
-        c.set_open_handler(bind(&on_open, &c, ::_1));
-        c.set_fail_handler(bind(&on_fail, &c, ::_1));
-        c.set_message_handler(bind(&on_message, &c, ::_1, ::_2));
-        c.set_close_handler(bind(&on_close, &c, ::_1));
+void tick() {
+    bool running = game.step();
+    trails.sync(game);
+    if (!running) {
+        gameState = GameOver;
+        winner = game.result();
+    }
+}
 
-        // Create a connection to the given URI
-        websocketpp::lib::error_code ec;
-        client::connection_ptr con = c.get_connection(uri, ec);
-        if (ec) {
-            std::cout << "Could not create connection because: " << ec.message() << std::endl;
-            is_connected = false;
-            return;
+// Take the heads of a state update from the server and mark the cells they moved into
+void applyHeads(const std::vector<tron_protocol::Head>& heads) {
+    game.players.resize(std::min<size_t>(heads.size(), tron_game::MAX_PLAYERS));
+    for (size_t i = 0; i < game.players.size(); ++i) {
+        const tron_protocol::Head& head = heads[i];
+        game.players[i] = {head.x, head.y, head.dir, head.alive};
+        if (head.alive && game.arena.inside(head.x, head.y)) {
+            game.arena.mark(head.x, head.y, static_cast<int>(i) + 1);
         }
+    }
+    trails.sync(game);
+}
 
-        // Note that connect here only gets a connection object. It does not
-        // actually start the connection or run any handlers.
-        c.connect(con);
+bool predicting() {
+    return gameState == Playing && isOnline && !roomLockstep && !isSpectating &&
+           mySlot >= 0 && mySlot < static_cast<int>(game.players.size());
+}
 
-        // Start the ASIO io_service run loop
-        c.run();
-    } catch (websocketpp::exception const & e) {
-        std::cout << e.what() << std::endl;
-        is_connected = false;
+// Tick to tag a turn of ours with, the next one on screen. Like the server, one turn per
+// tick: a second one goes to the tick after.
+uint32_t queueTurn(int dir) {
+    uint32_t tick = (predicting() ? predictedTick : newestServerTick) + 1;
+    while (sentTurns[tick % PREDICT_HISTORY].tick == tick) {
+        ++tick;
     }
+    sentTurns[tick % PREDICT_HISTORY] = {tick, dir};
+    return tick;
 }
 
-// Function to send message via WebSocket
-void send_websocket_message(const std::string& msg) {
-    if (is_connected) {
-        websocketpp::lib::error_code ec;
-        c.send(hdl, msg, websocketpp::frame::opcode::text, ec);
-        if (ec) {
-            std::cout << "Error sending message: " << ec.message() << std::endl;
+// Advance the match on screen to tick with our turn for it, the others going straight.
+// Who wins is the server's call, a predicted crash only stops that cycle.
+void predictStep(uint32_t tick) {
+    const SentTurn& turn = sentTurns[tick % PREDICT_HISTORY];
+    if (turn.tick == tick) {
+        game.turn(mySlot, turn.dir);
+    }
+    game.step();
+    trails.sync(game);
+    savePredicted(tick);
+}
+
+bool samePrediction(uint32_t tick, const std::vector<tron_protocol::Head>& heads) {
+    const PredictedTick& predicted = predictedTicks[tick % PREDICT_HISTORY];
+    if (heads.size() != game.players.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < heads.size(); ++i) {
+        const tron_game::Player& p = predicted.players[i];
+        if (p.alive != heads[i].alive || (p.alive && (p.x != heads[i].x || p.y != heads[i].y || p.dir != heads[i].dir))) {
+            return false;
         }
-    } else {
-        std::cout << "Not connected to send message." << std::endl;
+    }
+    return true;
+}
+
+// Take the heads of a server tick. A tick we are not ahead of is applied as it is. A
+// tick we predicted changes nothing if we got it right; otherwise the predicted ticks
+// from it on are undone, which is clearing the cells their heads marked, and played
+// again on top of the server's heads.
+void applyServerTick(uint32_t tick, const std::vector<tron_protocol::Head>& heads) {
+    lastServerTick = tick;
+    if (!predicting() || tick > predictedTick) {
+        applyHeads(heads);
+        savePredicted(tick);
+        predictedTick = tick;
+        predictTimer = 0;
+        return;
+    }
+    if (samePrediction(tick, heads)) {
+        return;
+    }
+    for (uint32_t t = predictedTick + 1; t-- > tick; ) {
+        const PredictedTick& predicted = predictedTicks[t % PREDICT_HISTORY];
+        for (size_t i = 0; i < game.players.size(); ++i) {
+            const tron_game::Player& p = predicted.players[i];
+            if (p.alive && game.arena.inside(p.x, p.y)) {
+                game.arena.clear(p.x, p.y);
+                trails.syncCell(game.arena, p.x, p.y);
+            }
+        }
+    }
+    applyHeads(heads);
+    savePredicted(tick);
+    for (uint32_t t = tick + 1; t <= predictedTick; ++t) {
+        predictStep(t);
     }
 }
 
+// Take the heads of a keyframe, whose cells the caller has put in the arena already, and
+// play our predicted ticks past it again
+void applyServerKeyframe(uint32_t tick, const std::vector<tron_protocol::Head>& heads) {
+    uint32_t predictedTo = predicting() ? predictedTick : 0;
+    lastServerTick = tick;
+    applyHeads(heads);
+    savePredicted(tick);
+    predictedTick = tick;
+    for (uint32_t t = tick + 1; t <= predictedTo; ++t) {
+        predictStep(t);
+        predictedTick = t;
+    }
+    trails.rebuild(game.arena);
+}
 
-void resetGame() {
-    // Reset player positions and directions
-    p1.x = 10; p1.y = 20; p1.dir = 3; p1.color = Color::Red; // Start moving right
-    p2.x = W - 11; p2.y = 20; p2.dir = 1; p2.color = Color::Blue; // Start moving left
+// Lockstep rooms send the turns of each tick instead of the heads and we run the match
+// ourselves, taking out first the slots in out that left the match before the tick. A
+// missed tick or a checksum that disagrees asks the server for a keyframe.
+void applyStep(uint32_t tick, const std::vector<int>& dirs, uint32_t checksum, uint32_t out) {
+    if (awaitingKeyframe) {
+        return;
+    }
+    if (tick == lastServerTick + 1 && dirs.size() == game.players.size()) {
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            if (out & (1u << i)) {
+                game.eliminate(static_cast<int>(i)); // Left the match before this tick
+            }
+        }
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            game.turn(static_cast<int>(i), dirs[i]);
+        }
+        game.step();
+        trails.sync(game);
+        lastServerTick = tick;
+        if (game.checksum() == checksum) {
+            return;
+        }
+        std::cout << "Lockstep desync at tick " << tick << std::endl;
+    }
+    awaitingKeyframe = true;
+    send_websocket_message("RESYNC");
+}
+
+// Heads of a text TICK or KEYFRAME, "x y dir" per player of the match, -1 -1 once out
+std::vector<tron_protocol::Head> readTextHeads(std::stringstream& ss) {
+    std::vector<tron_protocol::Head> heads(game.players.size());
+    for (tron_protocol::Head& head : heads) {
+        ss >> head.x >> head.y >> head.dir;
+        head.alive = head.x >= 0;
+    }
+    return heads;
+}
 
-    // Clear the field
-    for (int i=0; i<W; i++) {
-        for (int j=0; j<H; j++) {
-            field[i][j] = 0;
+// A text TICK, STEP or KEYFRAME as the state frame it stands for; false for other commands
+bool readTextUpdate(const std::string& command, std::stringstream& ss, tron_protocol::Frame& frame) {
+    if (command == "TICK") {
+        // TICK <heads> <tick>
+        frame.type = tron_protocol::FRAME_DELTA;
+        frame.heads = readTextHeads(ss);
+        ss >> frame.tick;
+    } else if (command == "STEP") {
+        // STEP <tick> <direction digit per player> <checksum in hex> [<slots out, hex bit mask>],
+        // lockstep rooms only
+        std::string digits;
+        frame.type = tron_protocol::FRAME_STEP;
+        ss >> frame.tick >> digits >> std::hex >> frame.checksum;
+        if (!(ss >> frame.out)) {
+            frame.out = 0;
         }
+        for (char digit : digits) {
+            frame.dirs.push_back((digit - '0') & 3);
+        }
+    } else if (command == "KEYFRAME") {
+        // KEYFRAME <tick> <heads as in TICK> then <owner>:<run> pairs over the field, row-major.
+        // Sent when the server corrected past ticks for a late turn.
+        frame.type = tron_protocol::FRAME_KEYFRAME;
+        ss >> frame.tick;
+        frame.heads = readTextHeads(ss);
+        frame.width = W;
+        frame.height = H;
+        frame.cells.assign(static_cast<size_t>(W) * H, 0);
+        size_t cell = 0;
+        int owner, run;
+        char colon;
+        while (cell < frame.cells.size() && ss >> owner >> colon >> run) {
+            for (; run > 0 && cell < frame.cells.size(); --run, ++cell) {
+                frame.cells[cell] = static_cast<uint8_t>(owner);
+            }
+        }
+    } else {
+        return false;
     }
-    // Place initial positions
-    field[p1.x][p1.y] = 1;
-    field[p2.x][p2.y] = 2;
+    return true;
 }
 
-void tick() {
-    // Player 1 movement
-    if (p1.dir == 0) p1.y += 1; // Down
-    if (p1.dir == 1) p1.x -= 1; // Left
-    if (p1.dir == 2) p1.y -= 1; // Up
-    if (p1.dir == 3) p1.x += 1; // Right
-
-    // Player 2 movement
-    if (p2.dir == 0) p2.y += 1; // Down
-    if (p2.dir == 1) p2.x -= 1; // Left
-    if (p2.dir == 2) p2.y -= 1; // Up
-    if (p2.dir == 3) p2.x += 1; // Right
-
-    // Collision detection
-    if (p1.x<0 || p1.x>=W || p1.y<0 || p1.y>=H || field[p1.x][p1.y]!=0) {
-        gameState = GameOver;
-        winner = "Player 2 Wins!";
+// Apply a state frame from the server, binary or read from text
+void applyServerUpdate(const tron_protocol::Frame& frame) {
+    if (frame.type == tron_protocol::FRAME_STEP) {
+        applyStep(frame.tick, frame.dirs, frame.checksum, frame.out);
         return;
     }
-    if (p2.x<0 || p2.x>=W || p2.y<0 || p2.y>=H || field[p2.x][p2.y]!=0) {
-        gameState = GameOver;
-        winner = "Player 1 Wins!";
-        return;
+    if (frame.type == tron_protocol::FRAME_KEYFRAME) {
+        awaitingKeyframe = false;
+        game.arena.reset();
+        for (int i=0; i<W; i++) {
+            for (int j=0; j<H && j<frame.height; j++) {
+                if (frame.cells[j * W + i] != 0) {
+                    game.arena.mark(i, j, frame.cells[j * W + i]);
+                }
+            }
+        }
+        applyServerKeyframe(frame.tick, frame.heads);
+    } else {
+        applyServerTick(frame.tick, frame.heads);
     }
+}
 
-    // Check for head-on collision
-    if (p1.x == p2.x && p1.y == p2.y) {
-        gameState = GameOver;
-        winner = "It's a Draw!";
+bool playingOut() {
+    return gameState == Playing && isOnline && !predicting();
+}
+
+// Apply the buffered ticks whose playout time has come
+void playOut(double now_ms) {
+    tron_protocol::Frame frame;
+    while (playout.pop(now_ms, frame)) {
+        applyServerUpdate(frame);
+    }
+}
+
+// Apply every buffered tick, once the match is no longer played out
+void flushPlayout() {
+    tron_protocol::Frame frame;
+    while (playout.pop_any(frame)) {
+        applyServerUpdate(frame);
+    }
+}
+
+// A state frame as it arrives: into the playout buffer, or straight into the match
+void receiveServerUpdate(tron_protocol::Frame frame, double received_ms) {
+    newestServerTick = std::max(newestServerTick, frame.tick);
+    if (playingOut()) {
+        playout.push(frame.tick, received_ms, std::move(frame));
         return;
     }
+    flushPlayout();
+    applyServerUpdate(frame);
+}
+
+// Cell the head of player i moves into with the next tick: where that tick's frame puts
+// it if it is buffered, otherwise straight on or with our turn for it. False if the head
+// stops where it is.
+bool nextHeadCell(size_t i, const tron_protocol::Frame* next, int& x, int& y) {
+    const tron_game::Player& p = game.players[i];
+    if (next && next->type != tron_protocol::FRAME_STEP) {
+        if (i >= next->heads.size() || !next->heads[i].alive) {
+            return false;
+        }
+        x = next->heads[i].x;
+        y = next->heads[i].y;
+        return std::abs(x - p.x) + std::abs(y - p.y) == 1;
+    }
+    int dir = p.dir;
+    if (next && i < next->dirs.size()) {
+        dir = next->dirs[i];
+    } else if (predicting() && static_cast<int>(i) == mySlot) {
+        const SentTurn& turn = sentTurns[(predictedTick + 1) % PREDICT_HISTORY];
+        if (turn.tick == predictedTick + 1) {
+            dir = turn.dir;
+        }
+    }
+    if (dir == (p.dir + 2) % 4) {
+        dir = p.dir; // Reversals are ignored
+    }
+    x = p.x + (dir == tron_game::RIGHT) - (dir == tron_game::LEFT);
+    y = p.y + (dir == tron_game::DOWN) - (dir == tron_game::UP);
+    return game.arena.inside(x, y) && !game.arena.occupied(x, y);
+}
 
-    // Mark trail
-    field[p1.x][p1.y] = 1;
-    field[p2.x][p2.y] = 2;
+// The living heads, in a lighter shade of their trail, each drawn progress of the way
+// (0 to 1) from its cell into the next one, so they move at the frame rate rather than a
+// cell per tick
+void drawHeads(RenderTarget& target, float progress) {
+    const tron_protocol::Frame* next = playingOut() ? playout.next() : nullptr;
+    VertexArray heads(Quads);
+    for (size_t i = 0; i < game.players.size(); ++i) {
+        const tron_game::Player& p = game.players[i];
+        if (!p.alive || !game.arena.inside(p.x, p.y)) {
+            continue;
+        }
+        float left = p.x * ts, top = p.y * ts;
+        int x, y;
+        if (nextHeadCell(i, next, x, y)) {
+            left += (x - p.x) * ts * progress;
+            top += (y - p.y) * ts * progress;
+        }
+        Color trail = playerColors[i % tron_game::MAX_PLAYERS];
+        Color color(trail.r / 2 + 128, trail.g / 2 + 128, trail.b / 2 + 128);
+        heads.append(Vertex(Vector2f(left, top), color));
+        heads.append(Vertex(Vector2f(left + ts, top), color));
+        heads.append(Vertex(Vector2f(left + ts, top + ts), color));
+        heads.append(Vertex(Vector2f(left, top + ts), color));
+    }
+    target.draw(heads);
 }
 
 int main() {
@@ -197,6 +718,8 @@ int main() {
         return -1; // error
     }
 
+    std::thread network = start_network();
+
     // Menu Text
     Text titleText("TRON", font, 80);
     titleText.setFillColor(Color::White);
@@ -297,11 +820,29 @@ int main() {
     leaveRoomButton.setFillColor(Color::Red);
     leaveRoomButton.setPosition(W*ts/2.0f - leaveRoomButton.getGlobalBounds().width/2.0f, H*ts - 100);
 
+    // Quick Match Button, toggles between queueing and cancelling
+    Text quickMatchButton("Partida Rapida", font, 40);
+    quickMatchButton.setFillColor(Color::Magenta);
+    quickMatchButton.setPosition(40, 250);
+
     // Start Game Button (initially hidden)
     Text startGameButton("Iniciar Jogo", font, 30);
     startGameButton.setFillColor(Color::Yellow);
     startGameButton.setPosition(W*ts/2.0f - startGameButton.getGlobalBounds().width/2.0f, H*ts - 150);
 
+    // Room size button for the creator, each click allows one more player (up to 16, then back to 2)
+    Text roomSizeButton("", font, 30);
+    roomSizeButton.setFillColor(Color::Cyan);
+
+    // Add Bot Button for the creator, seats a server bot
+    Text addBotButton("Adicionar Bot", font, 30);
+    addBotButton.setFillColor(Color::Magenta);
+    addBotButton.setPosition(W*ts/2.0f - addBotButton.getGlobalBounds().width/2.0f, H*ts - 250);
+
+    // Room mode button for the creator, switches between server state and lockstep
+    Text roomModeButton("", font, 30);
+    roomModeButton.setFillColor(Color::Cyan);
+
 
     resetGame();
 
@@ -317,8 +858,7 @@ int main() {
             if (e.type == Event::Closed) {
                 // Close WebSocket connection before closing window
                 if (is_connected) {
-                    websocketpp::lib::error_code ec;
-                    c.close(hdl, websocketpp::close::status::going_away, "", ec);
+                    close_websocket();
                 }
                 window.close();
             }
@@ -327,34 +867,32 @@ int main() {
                 if (gameState == Playing) {
                     if (isOnline) {
                         int new_dir = -1;
-                        // Player 1 (creator) uses WASD
-                        if (isRoomCreator) {
-                            if (e.key.code == Keyboard::W && p1.dir != 0) new_dir = 2; // Up
-                            if (e.key.code == Keyboard::S && p1.dir != 2) new_dir = 0; // Down
-                            if (e.key.code == Keyboard::A && p1.dir != 3) new_dir = 1; // Left
-                            if (e.key.code == Keyboard::D && p1.dir != 1) new_dir = 3; // Right
-                        }
-                        // Player 2 (joiner) uses Arrow Keys
-                        else {
-                            if (e.key.code == Keyboard::Up && p2.dir != 0) new_dir = 2;
-                            if (e.key.code == Keyboard::Down && p2.dir != 2) new_dir = 0;
-                            if (e.key.code == Keyboard::Left && p2.dir != 3) new_dir = 1;
-                            if (e.key.code == Keyboard::Right && p2.dir != 1) new_dir = 3;
+                        // WASD or the arrow keys steer our own cycle, whatever its slot
+                        if (e.key.code == Keyboard::W || e.key.code == Keyboard::Up) new_dir = 2;
+                        if (e.key.code == Keyboard::S || e.key.code == Keyboard::Down) new_dir = 0;
+                        if (e.key.code == Keyboard::A || e.key.code == Keyboard::Left) new_dir = 1;
+                        if (e.key.code == Keyboard::D || e.key.code == Keyboard::Right) new_dir = 3;
+                        bool mine = mySlot >= 0 && mySlot < static_cast<int>(game.players.size());
+                        if (!mine || new_dir == (game.players[mySlot].dir + 2) % 4) {
+                            new_dir = -1;
                         }
 
-                        if (new_dir != -1) {
-                            send_websocket_message("INPUT " + std::to_string(new_dir));
+                        if (new_dir != -1 && !isSpectating) {
+                            // Tagged with the tick on screen + 1, so the server can apply it where we pressed it
+                            uint32_t tick = queueTurn(new_dir);
+                            send_websocket_message("INPUT " + std::to_string(new_dir) + " " + std::to_string(tick));
                         }
                     } else { // Local game
-                        if (e.key.code == Keyboard::W && p1.dir != 0) p1.dir = 2; // Up
-                        if (e.key.code == Keyboard::S && p1.dir != 2) p1.dir = 0; // Down
-                        if (e.key.code == Keyboard::A && p1.dir != 3) p1.dir = 1; // Left
-                        if (e.key.code == Keyboard::D && p1.dir != 1) p1.dir = 3; // Right
-
-                        if (e.key.code == Keyboard::Up && p2.dir != 0) p2.dir = 2;
-                        if (e.key.code == Keyboard::Down && p2.dir != 2) p2.dir = 0;
-                        if (e.key.code == Keyboard::Left && p2.dir != 3) p2.dir = 1;
-                        if (e.key.code == Keyboard::Right && p2.dir != 1) p2.dir = 3;
+                        // Player 1 uses WASD, player 2 the arrow keys; reversals are ignored
+                        if (e.key.code == Keyboard::W) game.turn(0, 2); // Up
+                        if (e.key.code == Keyboard::S) game.turn(0, 0); // Down
+                        if (e.key.code == Keyboard::A) game.turn(0, 1); // Left
+                        if (e.key.code == Keyboard::D) game.turn(0, 3); // Right
+
+                        if (e.key.code == Keyboard::Up) game.turn(1, 2);
+                        if (e.key.code == Keyboard::Down) game.turn(1, 0);
+                        if (e.key.code == Keyboard::Left) game.turn(1, 1);
+                        if (e.key.code == Keyboard::Right) game.turn(1, 3);
                     }
                 } else if (gameState == MultiplayerMenu) {
                     if (e.key.code == Keyboard::Tab) {
@@ -381,16 +919,14 @@ int main() {
                         if (isRoomNameInputActive && !roomNameString.empty()) {
                             // Trigger create room
                             if (!is_connected) {
-                                std::thread t(connect_websocket, "ws://localhost:9002");
-                                t.detach();
+                                connect_websocket("ws://localhost:9002");
                             }
                             send_websocket_message("CREATE_ROOM " + roomNameString);
                             isRoomNameInputActive = false;
                         } else if (isRoomIdInputActive && !roomIdInputString.empty()) {
                             // Trigger join room
                             if (!is_connected) {
-                                std::thread t(connect_websocket, "ws://localhost:9002");
-                                t.detach();
+                                connect_websocket("ws://localhost:9002");
                             }
                             send_websocket_message("JOIN_ROOM " + roomIdInputString);
                             isRoomIdInputActive = false;
@@ -422,6 +958,10 @@ int main() {
                         }
                         if (multiplayerText.getGlobalBounds().contains(pos.x, pos.y)) {
                             gameState = MultiplayerMenu;
+                            // Connect right away so the list of open rooms shows up
+                            if (!is_connected) {
+                                connect_websocket("ws://localhost:9002");
+                            }
                         }
                         if (instructionsText.getGlobalBounds().contains(pos.x, pos.y)) {
                             gameState = Instructions;
@@ -443,8 +983,7 @@ int main() {
                                     isRoomCreator = false;
                                 }
                                 if (is_connected) {
-                                    websocketpp::lib::error_code ec;
-                                    c.close(hdl, websocketpp::close::status::going_away, "", ec);
+                                    close_websocket();
                                 }
                             }
                             isOnline = false;
@@ -471,8 +1010,7 @@ int main() {
                         if (createRoomButton.getGlobalBounds().contains(pos.x, pos.y)) {
                             if (!roomNameString.empty()) {
                                 if (!is_connected) {
-                                    std::thread t(connect_websocket, "ws://localhost:9002");
-                                    t.detach();
+                                    connect_websocket("ws://localhost:9002");
                                 }
                                 send_websocket_message("CREATE_ROOM " + roomNameString);
                             } else {
@@ -483,8 +1021,7 @@ int main() {
                         if (joinRoomButton.getGlobalBounds().contains(pos.x, pos.y)) {
                             if (!roomIdInputString.empty()) {
                                 if (!is_connected) {
-                                    std::thread t(connect_websocket, "ws://localhost:9002");
-                                    t.detach();
+                                    connect_websocket("ws://localhost:9002");
                                 }
                                 send_websocket_message("JOIN_ROOM " + roomIdInputString);
                             } else {
@@ -492,13 +1029,43 @@ int main() {
                                 roomStatusText.setFillColor(Color::Red);
                             }
                         }
+                        if (quickMatchButton.getGlobalBounds().contains(pos.x, pos.y) && currentRoomId.empty()) {
+                            send_websocket_message(isSearchingMatch ? "CANCEL_MATCH" : "QUICK_MATCH");
+                        }
+                        // Clicking a room of the lobby list joins it, or watches it once started
+                        if (currentRoomId.empty() && pos.x >= lobbyListX && pos.x < lobbyListX + 310 && pos.y >= lobbyListY) {
+                            int row = (pos.y - lobbyListY) / lobbyRowHeight;
+                            for (auto it = lobbyRooms.begin(); it != lobbyRooms.end() && row < lobbyMaxRows; ++it) {
+                                if (!isListed(it->second)) continue;
+                                if (row-- == 0) {
+                                    if (it->second.state == "started") {
+                                        send_websocket_message("SPECTATE " + it->first);
+                                    } else {
+                                        roomIdInputString = it->first;
+                                        send_websocket_message("JOIN_ROOM " + it->first);
+                                    }
+                                    break;
+                                }
+                            }
+                        }
                         if (leaveRoomButton.getGlobalBounds().contains(pos.x, pos.y) && !currentRoomId.empty()) {
                             send_websocket_message("LEAVE_ROOM " + currentRoomId);
                             currentRoomId = "";
                             isRoomCreator = false;
+                            isSpectating = false;
                             roomStatusText.setString("Status: Saiu da sala.");
                             roomStatusText.setFillColor(Color::White);
                         }
+                        if (roomSizeButton.getGlobalBounds().contains(pos.x, pos.y) && isRoomCreator && !currentRoomId.empty()) {
+                            int size = roomMaxPlayers < tron_game::MAX_PLAYERS ? roomMaxPlayers + 1 : 2;
+                            send_websocket_message("SET_ROOM players " + std::to_string(size));
+                        }
+                        if (roomModeButton.getGlobalBounds().contains(pos.x, pos.y) && isRoomCreator && !currentRoomId.empty()) {
+                            send_websocket_message(roomLockstep ? "SET_ROOM mode state" : "SET_ROOM mode lockstep");
+                        }
+                        if (addBotButton.getGlobalBounds().contains(pos.x, pos.y) && isRoomCreator && !currentRoomId.empty()) {
+                            send_websocket_message("ADD_BOT");
+                        }
                         if (startGameButton.getGlobalBounds().contains(pos.x, pos.y) && isRoomCreator && !currentRoomId.empty()) {
                             send_websocket_message("START_GAME " + currentRoomId);
                         }
@@ -513,8 +1080,7 @@ int main() {
                             }
                             // If connected but not in a room, disconnect
                             if (is_connected && currentRoomId.empty()) {
-                                websocketpp::lib::error_code ec;
-                                c.close(hdl, websocketpp::close::status::going_away, "", ec);
+                                close_websocket();
                             }
                         }
                     }
@@ -522,6 +1088,26 @@ int main() {
             }
         }
 
+        // Reconnect about once a second while our seat is held
+        if (resumePending && !is_connected) {
+            reconnectTimer += time;
+            if (reconnectTimer > 1) {
+                reconnectTimer = 0;
+                connect_websocket("ws://localhost:9002");
+            }
+        }
+
+        // Our own cycle runs on our clock, a few ticks ahead of the server at most
+        if (predicting()) {
+            predictTimer += time;
+            while (predictTimer >= serverTickMs / 1000.0f) {
+                predictTimer -= serverTickMs / 1000.0f;
+                if (predictedTick < lastServerTick + PREDICT_LIMIT) {
+                    predictStep(++predictedTick);
+                }
+            }
+        }
+
         if (gameState == Playing && !isOnline) {
             timer += time;
             if (timer > delay) {
@@ -530,18 +1116,53 @@ int main() {
             }
         }
 
-        // Process messages from queue
-        std::lock_guard<std::mutex> lock(mtx);
-        while (!message_queue.empty()) {
-            std::string msg = message_queue.front();
-            message_queue.pop();
+        // Lost events leave the lobby list and the match behind, ask for both again
+        if (net_events_lost.exchange(false)) {
+            std::cout << "Dropped messages from server, resyncing" << std::endl;
+            lobbyRooms.clear();
+            send_websocket_message("LIST_ROOMS all - 100");
+            if (gameState == Playing && isOnline) {
+                awaitingKeyframe = roomLockstep;
+                send_websocket_message("RESYNC");
+            }
+        }
+
+        // Process what the network thread received since the last frame
+        NetEvent net_msg;
+        while (net_events.try_pop(net_msg)) {
+            if (net_msg.kind == NetEvent::Opened) {
+                handleOpen();
+                continue;
+            } else if (net_msg.kind == NetEvent::Closed) {
+                handleClose();
+                continue;
+            } else if (net_msg.kind == NetEvent::Failed) {
+                handleFail();
+                continue;
+            }
+
+            if (net_msg.opcode == websocketpp::frame::opcode::binary) {
+                tron_protocol::Frame frame;
+                if (!tron_protocol::decode_frame(net_msg.payload, W, frame) ||
+                    (frame.type == tron_protocol::FRAME_STEP ? frame.dirs.size() : frame.heads.size()) < 2) {
+                    std::cout << "Invalid state frame from server" << std::endl;
+                    continue;
+                }
+                receiveServerUpdate(std::move(frame), net_msg.received_ms);
+                continue;
+            }
+
+            std::string msg = net_msg.payload;
             std::cout << "Received from server: " << msg << std::endl;
             // Process server messages
             std::stringstream ss(msg);
             std::string command;
             ss >> command;
 
-            if (command == "ROOM_CREATED") {
+            tron_protocol::Frame update{};
+            if (readTextUpdate(command, ss, update)) {
+                receiveServerUpdate(std::move(update), net_msg.received_ms);
+            } else if (command == "ROOM_CREATED") {
                 ss >> currentRoomId;
                 roomStatusText.setString("Sala criada! ID: " + currentRoomId + ". Aguardando jogadores...");
                 roomStatusText.setFillColor(Color::Green);
@@ -551,27 +1172,90 @@ int main() {
                 roomStatusText.setString("Entrou na sala! ID: " + currentRoomId + ". Aguardando inicio...");
                 roomStatusText.setFillColor(Color::Blue);
                 isRoomCreator = false; // Only creator can start
+            } else if (command == "RESUME_TOKEN") {
+                // RESUME_TOKEN <room_id> <token>, replaces the previous one
+                std::string r_id;
+                ss >> r_id >> resumeToken;
+            } else if (command == "RESUMED") {
+                // RESUMED <room_id> <our slot, -1 outside a match> <players> <tick_ms> <1 if a match is running>
+                int players = 2, tick_ms = 0, started = 0;
+                ss >> currentRoomId >> mySlot >> players >> tick_ms >> started;
+                if (tick_ms > 0) {
+                    serverTickMs = tick_ms;
+                }
+                resumePending = false;
+                roomStatusText.setString("Reconectado a sala " + currentRoomId);
+                roomStatusText.setFillColor(Color::Green);
+                if (started) {
+                    gameState = Playing;
+                    isOnline = true;
+                    lastServerTick = 0;
+                    awaitingKeyframe = false;
+                    resetGame(players); // The keyframe that follows fills in the field
+                }
             } else if (command == "ERROR") {
                 std::string error_msg;
                 std::getline(ss, error_msg);
+                if (resumePending) {
+                    // Our seat is gone, the match went on without us
+                    resumePending = false;
+                    resumeToken = "";
+                    if (gameState == Playing) {
+                        gameState = GameOver;
+                        winner = "Conexao perdida";
+                    }
+                }
                 roomStatusText.setString("Erro: " + error_msg);
                 roomStatusText.setFillColor(Color::Red);
                 currentRoomId = "";
                 isRoomCreator = false;
+                isSpectating = false;
+            } else if (command == "SPECTATING") {
+                // SPECTATING <room_id> <1 if a match is running> <players> <tick_ms>
+                int started = 0, players = 2, tick_ms = 0;
+                ss >> currentRoomId >> started >> players >> tick_ms;
+                if (tick_ms > 0) {
+                    serverTickMs = tick_ms;
+                }
+                isSpectating = true;
+                isRoomCreator = false;
+                roomStatusText.setString("Assistindo a sala " + currentRoomId);
+                roomStatusText.setFillColor(Color::Cyan);
+                if (started) {
+                    gameState = Playing;
+                    isOnline = true;
+                    lastServerTick = 0;
+                    awaitingKeyframe = false;
+                    mySlot = -1;
+                    resetGame(players); // The keyframe that follows fills in the field
+                }
+            } else if (command == "ROOM_CLOSED") {
+                // Spectated room gone, or our own room closed for being idle
+                currentRoomId = "";
+                isSpectating = false;
+                isRoomCreator = false;
+                resumeToken = "";
+                roomStatusText.setString("Status: A sala foi encerrada.");
+                roomStatusText.setFillColor(Color::White);
+                if (gameState == Playing) {
+                    gameState = GameOver;
+                    winner = "Sala encerrada";
+                }
             } else if (command == "GAME_START") {
+                // GAME_START <room_id> <our slot, -1 when watching> <players> <tick_ms>
+                std::string r_id;
+                int players = 2;
+                ss >> r_id >> mySlot >> players >> serverTickMs;
+                serverTickMs = std::max(1, serverTickMs);
                 gameState = Playing;
                 isOnline = true;
-                resetGame();
+                lastServerTick = 0;
+                awaitingKeyframe = false;
+                resetGame(players);
                 roomStatusText.setString("Jogo iniciado!");
                 roomStatusText.setFillColor(Color::Yellow);
-            } else if (command == "TICK") {
-                int p1x, p1y, p1d, p2x, p2y, p2d;
-                ss >> p1x >> p1y >> p1d >> p2x >> p2y >> p2d;
-                p1.x = p1x; p1.y = p1y; p1.dir = p1d;
-                p2.x = p2x; p2.y = p2y; p2.dir = p2d;
-                if (p1.x >= 0 && p1.x < W && p1.y >= 0 && p1.y < H) field[p1.x][p1.y] = 1;
-                if (p2.x >= 0 && p2.x < W && p2.y >= 0 && p2.y < H) field[p2.x][p2.y] = 2;
             } else if (command == "GAME_OVER") {
+                flushPlayout(); // The last ticks, before the result goes over them
                 std::string winner_msg;
                 std::getline(ss, winner_msg);
                 if (!winner_msg.empty() && winner_msg[0] == ' ') {
@@ -580,17 +1264,63 @@ int main() {
                 gameState = GameOver;
                 winner = winner_msg;
             }
+            else if (command == "ROOM_LIST") {
+                // ROOM_LIST <count> <cursor>, then one "<id> <players> <max> <state> <name>" line per room
+                std::string line;
+                std::getline(ss, line);
+                lobbyRooms.clear();
+                while (std::getline(ss, line)) {
+                    std::stringstream room_ss(line);
+                    std::string r_id;
+                    LobbyRoom room;
+                    room_ss >> r_id >> room.players >> room.max_players >> room.state;
+                    std::getline(room_ss >> std::ws, room.name);
+                    lobbyRooms[r_id] = room;
+                }
+            } else if (command == "LOBBY_ADD" || command == "LOBBY_UPDATE" || command == "LOBBY_REMOVE") {
+                // The server batches lobby changes, one per line
+                std::stringstream lines(msg);
+                std::string line;
+                while (std::getline(lines, line)) {
+                    applyLobbyDiff(line);
+                }
+            } else if (command == "MATCH_QUEUED") {
+                isSearchingMatch = true;
+                roomStatusText.setString("Procurando oponente...");
+                roomStatusText.setFillColor(Color::White);
+            } else if (command == "MATCH_CANCELLED") {
+                isSearchingMatch = false;
+                roomStatusText.setString("Busca cancelada.");
+                roomStatusText.setFillColor(Color::White);
+            } else if (command == "MATCH_FOUND") {
+                // MATCH_FOUND <room_id> <slot>; slot 0 plays as player 1
+                int slot = 0;
+                ss >> currentRoomId >> slot;
+                isSearchingMatch = false;
+                isRoomCreator = slot == 0;
+                roomStatusText.setString("Oponente encontrado! Sala " + currentRoomId);
+                roomStatusText.setFillColor(Color::Green);
+            }
             else if (command == "ROOM_UPDATE") {
-                // Example: ROOM_UPDATE <room_id> <player_count> <max_players>
-                std::string r_id;
+                // Example: ROOM_UPDATE <room_id> <player_count> <max_players> <state|lockstep>
+                std::string r_id, mode;
                 int player_count, max_players;
-                ss >> r_id >> player_count >> max_players;
+                ss >> r_id >> player_count >> max_players >> mode;
+                roomMaxPlayers = max_players;
+                roomLockstep = mode == "lockstep";
                 roomStatusText.setString("Sala " + r_id + ": " + std::to_string(player_count) + "/" + std::to_string(max_players) + " jogadores.");
                 roomStatusText.setFillColor(Color::White);
             }
         }
         // End process messages from queue
 
+        // Buffered ticks go on screen as their playout time comes
+        if (playingOut()) {
+            playOut(steadyMs());
+        } else {
+            flushPlayout();
+        }
+
 
         // Drawing
         window.clear(Color::Black); // Clear to black instead of drawing background sprite
@@ -602,16 +1332,16 @@ int main() {
             window.draw(instructionsText);
             window.draw(exitText);
         } else if (gameState == Playing || gameState == GameOver) {
-            for (int i=0; i<W; i++) {
-                for (int j=0; j<H; j++) {
-                    if (field[i][j] == 0) continue;
-                    RectangleShape r(Vector2f(ts, ts));
-                    r.setPosition(i*ts, j*ts);
-                    if (field[i][j] == 1) r.setFillColor(p1.color);
-                    if (field[i][j] == 2) r.setFillColor(p2.color);
-                    window.draw(r);
-                }
+            window.draw(trails);
+            float progress = 0;
+            if (gameState == Playing && !isOnline) {
+                progress = timer / delay;
+            } else if (playingOut()) {
+                progress = playout.progress();
+            } else if (predicting() && predictedTick < lastServerTick + PREDICT_LIMIT) {
+                progress = predictTimer * 1000 / serverTickMs;
             }
+            drawHeads(window, std::min(1.0f, progress));
 
             if (gameState == GameOver) {
                 RectangleShape overlay(Vector2f(W*ts, H*ts));
@@ -663,10 +1393,41 @@ int main() {
 
             window.draw(roomStatusText);
 
+            // Open rooms and running matches, click one to join or watch it
+            if (currentRoomId.empty()) {
+                quickMatchButton.setString(isSearchingMatch ? "Cancelar Busca" : "Partida Rapida");
+                window.draw(quickMatchButton);
+
+                Text lobbyTitle("Salas", font, 30);
+                lobbyTitle.setFillColor(Color::White);
+                lobbyTitle.setPosition(lobbyListX, lobbyListY - 40);
+                window.draw(lobbyTitle);
+                int row = 0;
+                for (const auto& entry : lobbyRooms) {
+                    if (!isListed(entry.second)) continue;
+                    if (row == lobbyMaxRows) break;
+                    bool started = entry.second.state == "started";
+                    Text roomEntry(entry.first + "  " + std::to_string(entry.second.players) + "/" +
+                                   std::to_string(entry.second.max_players) + "  " + entry.second.name +
+                                   (started ? " (assistir)" : ""), font, 22);
+                    roomEntry.setFillColor(started ? Color::Yellow : Color::Cyan);
+                    roomEntry.setPosition(lobbyListX, lobbyListY + row * lobbyRowHeight);
+                    window.draw(roomEntry);
+                    ++row;
+                }
+            }
+
             if (!currentRoomId.empty()) {
                 window.draw(leaveRoomButton);
                 if (isRoomCreator) { // Only creator can start game
                     window.draw(startGameButton);
+                    roomSizeButton.setString("Jogadores: " + std::to_string(roomMaxPlayers) + " (+)");
+                    roomSizeButton.setPosition(W*ts/2.0f - roomSizeButton.getGlobalBounds().width/2.0f, H*ts - 200);
+                    window.draw(roomSizeButton);
+                    roomModeButton.setString(roomLockstep ? "Modo: lockstep" : "Modo: estado");
+                    roomModeButton.setPosition(W*ts/2.0f - roomModeButton.getGlobalBounds().width/2.0f, H*ts - 300);
+                    window.draw(roomModeButton);
+                    window.draw(addBotButton);
                 }
             }
 
@@ -677,5 +1438,7 @@ int main() {
         window.display();
     }
 
+    net_command({NetCommand::Stop, ""});
+    network.join();
     return 0;
 }
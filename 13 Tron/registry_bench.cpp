@@ -0,0 +1,167 @@
+// Microbenchmark for the tron_server room and connection registry (tron_registry.hpp).
+//
+// Replays the registry work the server does for a full lobby: open connections, create
+// rooms, join them, look rooms up from incoming messages, leave and disconnect.
+//
+// Usage: tron_registry_bench [--rooms N] [--lookups N] [--threads N]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tron_registry.hpp"
+
+using tron_registry::conn_id;
+using tron_registry::room_key;
+
+// Same shape as the server's entries, without the websocket parts
+struct BenchRoom {
+    room_key key;
+    std::vector<conn_id> players;
+};
+
+struct BenchClient {
+    room_key room = tron_registry::NO_ROOM;
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+void report(const std::string& name, size_t ops, bench_clock::time_point start) {
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+    std::cout << std::left << std::setw(22) << name
+              << std::right << std::setw(10) << ops << " ops "
+              << std::setw(10) << std::fixed << std::setprecision(1) << seconds * 1e9 / ops << " ns/op "
+              << std::setw(12) << std::setprecision(0) << ops / seconds << " ops/s" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t room_count = 100000;
+    size_t lookup_count = 1000000;
+    int thread_count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--rooms" && i + 1 < argc) {
+            room_count = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--lookups" && i + 1 < argc) {
+            lookup_count = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            thread_count = std::max(1, std::atoi(argv[++i]));
+        }
+    }
+
+    tron_registry::ShardedTable<room_key, std::shared_ptr<BenchRoom>> rooms;
+    tron_registry::ShardedTable<conn_id, BenchClient> clients;
+    tron_registry::ConnectionIds ids;
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<room_key> key_distribution(0, tron_registry::ROOM_KEY_COUNT - 1);
+
+    std::cout << "Registry benchmark: " << room_count << " rooms, " << room_count * 2 << " connections" << std::endl;
+
+    // Two connections per room
+    std::vector<conn_id> connections(room_count * 2);
+    auto start = bench_clock::now();
+    for (conn_id& id : connections) {
+        id = ids.next();
+        clients.insert(id, BenchClient());
+    }
+    report("open connection", connections.size(), start);
+
+    std::vector<room_key> keys(room_count);
+    start = bench_clock::now();
+    for (size_t i = 0; i < room_count; ++i) {
+        auto room = std::make_shared<BenchRoom>();
+        do {
+            room->key = key_distribution(generator);
+        } while (!rooms.insert(room->key, room));
+        room->players.push_back(connections[2 * i]);
+        clients.modify(connections[2 * i], [&](BenchClient& c) { c.room = room->key; return true; });
+        keys[i] = room->key;
+    }
+    report("create room", room_count, start);
+
+    // Joins go through the textual id the player typed
+    std::vector<std::string> typed_ids(room_count);
+    for (size_t i = 0; i < room_count; ++i) {
+        typed_ids[i] = tron_registry::unpack_room_id(keys[i]);
+    }
+    start = bench_clock::now();
+    for (size_t i = 0; i < room_count; ++i) {
+        room_key key;
+        std::shared_ptr<BenchRoom> room;
+        if (tron_registry::pack_room_id(typed_ids[i], key) && rooms.find(key, room)) {
+            room->players.push_back(connections[2 * i + 1]);
+            clients.modify(connections[2 * i + 1], [&](BenchClient& c) { c.room = key; return true; });
+        }
+    }
+    report("join room", room_count, start);
+
+    // Message path: connection id -> client -> room, from every thread at once
+    start = bench_clock::now();
+    std::vector<std::thread> workers;
+    size_t per_thread = lookup_count / thread_count;
+    for (int t = 0; t < thread_count; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 local(static_cast<unsigned>(t));
+            std::uniform_int_distribution<size_t> pick(0, connections.size() - 1);
+            size_t found = 0;
+            for (size_t i = 0; i < per_thread; ++i) {
+                BenchClient client;
+                std::shared_ptr<BenchRoom> room;
+                if (clients.find(connections[pick(local)], client) && rooms.find(client.room, room)) {
+                    ++found;
+                }
+            }
+            if (found != per_thread) {
+                std::cerr << "lookup mismatch on thread " << t << std::endl;
+            }
+        });
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+    report("message lookup (" + std::to_string(thread_count) + "t)", per_thread * thread_count, start);
+
+    // Joiners leave their rooms
+    start = bench_clock::now();
+    for (size_t i = 0; i < room_count; ++i) {
+        conn_id id = connections[2 * i + 1];
+        BenchClient client;
+        std::shared_ptr<BenchRoom> room;
+        if (clients.find(id, client) && rooms.find(client.room, room)) {
+            clients.modify(id, [&](BenchClient& c) { c.room = tron_registry::NO_ROOM; return true; });
+            for (size_t p = 0; p < room->players.size(); ++p) {
+                if (room->players[p] == id) {
+                    room->players[p] = room->players.back();
+                    room->players.pop_back();
+                    break;
+                }
+            }
+        }
+    }
+    report("leave room", room_count, start);
+
+    // Everyone disconnects, closing the rooms that become empty
+    start = bench_clock::now();
+    for (conn_id id : connections) {
+        BenchClient client;
+        std::shared_ptr<BenchRoom> room;
+        if (clients.erase(id, &client) && client.room != tron_registry::NO_ROOM && rooms.find(client.room, room)) {
+            room->players.clear();
+            rooms.erase(room->key);
+        }
+    }
+    report("disconnect cleanup", connections.size(), start);
+
+    if (rooms.size() != 0 || clients.size() != 0) {
+        std::cerr << "registry not empty after cleanup: " << rooms.size() << " rooms, "
+                  << clients.size() << " clients" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,267 @@
+// Reader for tron_server match recordings (tron_record.hpp).
+//
+// Maps a .tronrec file into memory and rebuilds the arena at any tick: the keyframe
+// index is binary searched for the last keyframe at or before the tick, and only the
+// deltas after it are applied.
+//
+// Usage: tron_replay FILE                  print what the recording holds
+//        tron_replay FILE --tick N         print the arena at tick N
+//        tron_replay FILE --play [--from N] [--speed X]
+//                                          play the match in the terminal
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tron_protocol.hpp"
+#include "tron_record.hpp"
+
+// Arena at one tick of the recording
+struct ReplayState {
+    uint32_t tick = 0;
+    std::vector<uint8_t> cells; // Owner per cell, row-major (0 = empty)
+    std::vector<tron_protocol::Head> heads;
+    uint64_t next_offset = 0;   // Record after this tick
+};
+
+class Replay {
+public:
+    ~Replay() {
+        if (data) {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+    }
+
+    bool open(const std::string& path, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = "cannot open " + path;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            error = "cannot read " + path;
+            return false;
+        }
+        size = static_cast<size_t>(info.st_size);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            error = "cannot map " + path;
+            return false;
+        }
+        data = static_cast<const uint8_t*>(mapped);
+
+        if (!tron_record::decode_file_header(data, size, header)) {
+            error = path + " is not a Tron recording";
+            return false;
+        }
+        complete = tron_record::read_index(data, size, index, records_end);
+        if (!complete) {
+            // Cut short, the server stopped before the match ended
+            tron_record::scan_index(data, size, header.players,
+                [](const uint8_t* frame, size_t length) { return length > 0 && frame[0] == tron_protocol::FRAME_KEYFRAME; },
+                index, records_end);
+        }
+        if (index.empty()) {
+            error = path + " holds no keyframe";
+            return false;
+        }
+        return true;
+    }
+
+    // Rebuild the arena at tick: O(log keyframes) to find the keyframe, then at most one
+    // keyframe interval of deltas
+    bool seek(uint32_t tick, ReplayState& state) const {
+        const tron_record::IndexEntry* entry = tron_record::find_keyframe(index, tick);
+        if (!entry) {
+            return false;
+        }
+        tron_record::RecordView record;
+        tron_protocol::Frame frame;
+        if (!tron_record::read_record(data, records_end, entry->offset, record) || !decode_tick(record, frame) ||
+            frame.type != tron_protocol::FRAME_KEYFRAME) {
+            return false;
+        }
+        state.cells = frame.cells;
+        state.cells.resize(static_cast<size_t>(header.width) * header.height);
+        apply_heads(frame, state);
+        state.next_offset = entry->offset + tron_record::RECORD_HEADER_SIZE + record.length;
+        while (state.tick < tick) {
+            if (!step(state)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Advance to the next tick; false at the end of the match
+    bool step(ReplayState& state) const {
+        tron_record::RecordView record;
+        tron_protocol::Frame frame;
+        if (!tron_record::read_record(data, records_end, state.next_offset, record) ||
+            record.type != tron_record::RECORD_TICK || !decode_tick(record, frame)) {
+            return false;
+        }
+        if (frame.type == tron_protocol::FRAME_KEYFRAME) {
+            state.cells = frame.cells;
+            state.cells.resize(static_cast<size_t>(header.width) * header.height);
+        }
+        apply_heads(frame, state);
+        state.next_offset += tron_record::RECORD_HEADER_SIZE + record.length;
+        return true;
+    }
+
+    // Walk the record headers for the tick count and the result
+    void summarize(uint32_t& first_tick, uint32_t& last_tick, std::string& result) const {
+        first_tick = last_tick = 0;
+        result.clear();
+        uint64_t offset = tron_record::FILE_HEADER_SIZE;
+        tron_record::RecordView record;
+        while (tron_record::read_record(data, records_end, offset, record)) {
+            if (record.type == tron_record::RECORD_TICK) {
+                if (first_tick == 0) {
+                    first_tick = record.tick;
+                }
+                last_tick = record.tick;
+            } else if (record.type == tron_record::RECORD_END) {
+                result.assign(reinterpret_cast<const char*>(record.payload), record.length);
+            } else {
+                break;
+            }
+            offset += tron_record::RECORD_HEADER_SIZE + record.length;
+        }
+    }
+
+    tron_record::FileHeader header;
+    std::vector<tron_record::IndexEntry> index;
+    bool complete = false; // Has the index trailer
+    size_t size = 0;
+
+private:
+    bool decode_tick(const tron_record::RecordView& record, tron_protocol::Frame& frame) const {
+        size_t inputs = static_cast<size_t>(header.players);
+        if (record.type != tron_record::RECORD_TICK || record.length <= inputs) {
+            return false;
+        }
+        std::string encoded(reinterpret_cast<const char*>(record.payload + inputs), record.length - inputs);
+        return tron_protocol::decode_frame(encoded, header.width, frame);
+    }
+
+    // Every head marks the cell it moved into, as on the server
+    void apply_heads(const tron_protocol::Frame& frame, ReplayState& state) const {
+        state.tick = frame.tick;
+        state.heads = frame.heads;
+        for (size_t i = 0; i < frame.heads.size(); ++i) {
+            const tron_protocol::Head& head = frame.heads[i];
+            if (head.alive && head.x >= 0 && head.x < header.width && head.y >= 0 && head.y < header.height) {
+                state.cells[static_cast<size_t>(head.y) * header.width + head.x] = static_cast<uint8_t>(i + 1);
+            }
+        }
+    }
+
+    const uint8_t* data = nullptr;
+    uint64_t records_end = 0;
+};
+
+void print_arena(const Replay& replay, const ReplayState& state) {
+    int width = replay.header.width, height = replay.header.height;
+    std::string out = "tick " + std::to_string(state.tick) + "\n";
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            char c = '.';
+            uint8_t owner = state.cells[static_cast<size_t>(y) * width + x];
+            if (owner > 0) {
+                c = static_cast<char>(owner < 10 ? '0' + owner : 'a' + owner - 10);
+            }
+            for (size_t i = 0; i < state.heads.size(); ++i) {
+                if (state.heads[i].alive && state.heads[i].x == x && state.heads[i].y == y) {
+                    c = static_cast<char>('A' + i); // Head of player i + 1
+                }
+            }
+            out += c;
+        }
+        out += '\n';
+    }
+    std::cout << out << std::flush;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: tron_replay FILE [--tick N | --play [--from N] [--speed X]]" << std::endl;
+        return 1;
+    }
+    std::string path = argv[1];
+    long tick = -1, from = 1;
+    bool play = false;
+    double speed = 1.0;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--tick" && i + 1 < argc) {
+            tick = std::atol(argv[++i]);
+        } else if (arg == "--play") {
+            play = true;
+        } else if (arg == "--from" && i + 1 < argc) {
+            from = std::atol(argv[++i]);
+        } else if (arg == "--speed" && i + 1 < argc) {
+            speed = std::atof(argv[++i]);
+        } else {
+            std::cout << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    Replay replay;
+    std::string error;
+    if (!replay.open(path, error)) {
+        std::cout << error << std::endl;
+        return 1;
+    }
+
+    if (tick >= 0) {
+        ReplayState state;
+        if (!replay.seek(static_cast<uint32_t>(tick), state)) {
+            std::cout << "Tick " << tick << " is not in the recording" << std::endl;
+            return 1;
+        }
+        print_arena(replay, state);
+        return 0;
+    }
+
+    if (play) {
+        ReplayState state;
+        if (!replay.seek(static_cast<uint32_t>(std::max(1L, from)), state)) {
+            std::cout << "Tick " << from << " is not in the recording" << std::endl;
+            return 1;
+        }
+        auto frame_time = std::chrono::duration<double, std::milli>(replay.header.tick_ms / (speed > 0 ? speed : 1.0));
+        do {
+            std::cout << "\x1b[H\x1b[2J";
+            print_arena(replay, state);
+            std::this_thread::sleep_for(frame_time);
+        } while (replay.step(state));
+        return 0;
+    }
+
+    uint32_t first_tick, last_tick;
+    std::string result;
+    replay.summarize(first_tick, last_tick, result);
+    std::cout << "room        " << replay.header.room_id << std::endl
+              << "arena       " << replay.header.width << "x" << replay.header.height
+              << ", " << replay.header.players << " players, " << replay.header.tick_ms << " ms ticks" << std::endl
+              << "started     " << replay.header.start_ms << " (Unix ms)" << std::endl
+              << "ticks       " << first_tick << " to " << last_tick << std::endl
+              << "keyframes   " << replay.index.size() << (replay.complete ? "" : " (rebuilt, recording was cut short)") << std::endl
+              << "result      " << (result.empty() ? "unfinished" : result) << std::endl
+              << "file size   " << replay.size << " bytes" << std::endl;
+    return 0;
+}
@@ -0,0 +1,642 @@
+// Front end spreading Tron rooms over several tron_server processes on one host.
+//
+// tron_router starts --workers N tron_server processes (fork/exec), shard I with
+// --shard I/N listening on 127.0.0.1 at --worker-port + I (--port + 1 by default), and
+// accepts the players' websocket connections on --port itself. A player gets a websocket
+// to a worker only once it sends that worker something, and every command is routed:
+//   - CREATE_ROOM goes to the shard with the fewest seated players and spectators
+//   - JOIN_ROOM, SPECTATE and RESUME go to the shard owning the room id or the token,
+//     which tron_registry::shard_of computes from the id alone: workers only hand out
+//     room ids and tokens that hash to themselves
+//   - QUICK_MATCH goes to shard 0, which holds the only matchmaking queue, preceded by
+//     RTT <ms> with the player's round trip when it is known
+//   - LIST_ROOMS walks the shards in order, SUBSCRIBE_LOBBY reaches all of them
+//   - everything else goes to the shard of the player's room
+// Replies are passed through unchanged, so a client cannot tell the router from a single
+// tron_server. A worker that dies is started again: its players are disconnected and
+// the other shards carry on.
+//
+// The workers only see the router's connections, which answer their pings, so the router
+// pings the players itself: on connect, to time the round trip, and after --idle-s
+// seconds of silence, closing the player if the pong is not back within ten seconds.
+//
+// Known limit: with a single matchmaking queue every quick match is played on shard 0,
+// however many workers there are. Only created rooms are spread over the shards.
+//
+// Usage: tron_router [--workers N] [--port P] [--worker-port P] [--server PATH]
+//                    [--idle-s N] [--threads N] [-- tron_server options]
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/server.hpp>
+#include <websocketpp/client.hpp>
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tron_log.hpp"
+#include "tron_protocol.hpp"
+#include "tron_registry.hpp"
+
+typedef websocketpp::server<websocketpp::config::asio> server;
+typedef websocketpp::client<websocketpp::config::asio_client> client;
+typedef websocketpp::config::asio::message_type::ptr message_ptr;
+typedef websocketpp::connection_hdl connection_hdl;
+typedef websocketpp::lib::asio::steady_timer steady_timer;
+typedef std::chrono::steady_clock steady_clock;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+using websocketpp::lib::bind;
+
+struct Options {
+    int workers = 2;
+    int port = 9002;
+    int worker_port = 0; // Port of shard 0, the next ones follow; port + 1 unless given
+    int idle_s = 120;    // 0 leaves silent players connected
+    int threads = 1;
+    std::string server_path = "./tron_server";
+    std::vector<std::string> server_args; // Passed on to every worker
+};
+
+const std::chrono::seconds idle_ping_wait(10);
+
+// One tron_server process
+struct Worker {
+    int index;
+    int port; // On 127.0.0.1
+    pid_t pid = -1;
+    std::atomic<int> seated{0}; // Players and spectators in its rooms or queue, for placing creates
+};
+
+Options options;
+std::vector<std::unique_ptr<Worker>> workers;
+std::atomic<bool> stopping{false};
+server router;
+client upstream; // Connections from the router to the workers
+
+// Websocket to one worker on behalf of one player. Messages sent before it opens wait in pending.
+struct Upstream {
+    client::connection_ptr con;
+    bool open = false;
+    std::vector<std::string> pending;
+};
+
+// LIST_ROOMS in progress: asks the shards one after the other until the page is full
+struct ListRequest {
+    bool active = false;
+    std::string filter;
+    size_t limit = 0;
+    int shard = 0;
+    std::vector<std::string> rooms; // Room lines collected so far
+};
+
+// One player connection. Its handlers and those of its upstreams run on any router
+// thread, so everything here is behind mtx.
+struct Session {
+    std::mutex mtx;
+    server::connection_ptr con;
+    bool binary = false;
+    bool closed = false;
+    std::vector<Upstream> upstreams; // By shard
+    int home = -1;       // Shard of the player's room, or of the last command placing it
+    bool seated = false; // Counted in workers[home]->seated
+    ListRequest list;
+    int rtt_ms = -1;                       // From the last pong, -1 until one came back
+    steady_clock::time_point last_activity; // Last message or pong from the player
+    bool idle_ping = false;                 // Pinged for being silent
+    std::unique_ptr<steady_timer> idle_timer;
+};
+typedef std::shared_ptr<Session> session_ptr;
+
+void on_upstream_open(session_ptr session, int shard, connection_hdl);
+void on_upstream_message(session_ptr session, int shard, connection_hdl, message_ptr msg);
+void on_upstream_close(session_ptr session, int shard, connection_hdl);
+
+// Close the player's connection and every upstream. Called with the session locked.
+void close_session(Session& session, const std::string& reason) {
+    if (session.closed) {
+        return;
+    }
+    session.closed = true;
+    if (session.idle_timer) {
+        session.idle_timer->cancel();
+    }
+    if (session.seated) {
+        workers[session.home]->seated.fetch_sub(1, std::memory_order_relaxed);
+        session.seated = false;
+    }
+    websocketpp::lib::error_code ec;
+    for (Upstream& up : session.upstreams) {
+        if (up.con) {
+            up.con->close(websocketpp::close::status::going_away, "", ec);
+        }
+    }
+    session.con->close(websocketpp::close::status::going_away, reason, ec);
+}
+
+// Open a websocket to a worker. A worker that is down shows up as the upstream failing,
+// which closes the session.
+bool open_upstream(const session_ptr& session, int shard) {
+    websocketpp::lib::error_code ec;
+    client::connection_ptr con = upstream.get_connection("ws://127.0.0.1:" + std::to_string(workers[shard]->port) + "/", ec);
+    if (ec) {
+        TRON_LOG(Warn, "", 0, "Cannot reach shard %d: %s", shard, ec.message().c_str());
+        return false;
+    }
+    if (session->binary) {
+        con->add_subprotocol(tron_protocol::SUBPROTOCOL);
+    }
+    con->set_open_handler(bind(&on_upstream_open, session, shard, ::_1));
+    con->set_message_handler(bind(&on_upstream_message, session, shard, ::_1, ::_2));
+    con->set_close_handler(bind(&on_upstream_close, session, shard, ::_1));
+    con->set_fail_handler(bind(&on_upstream_close, session, shard, ::_1));
+    session->upstreams[shard].con = con;
+    upstream.connect(con);
+    return true;
+}
+
+// Send a command to one shard, opening the upstream on first use. Called with the session locked.
+void forward(const session_ptr& session, int shard, const std::string& payload) {
+    Upstream& up = session->upstreams[shard];
+    if (!up.con && !open_upstream(session, shard)) {
+        close_session(*session, "Shard unavailable");
+        return;
+    }
+    if (!up.open) {
+        up.pending.push_back(payload);
+        return;
+    }
+    websocketpp::lib::error_code ec = up.con->send(payload, websocketpp::frame::opcode::text);
+    if (ec) {
+        TRON_LOG(Warn, "", 0, "Error forwarding to shard %d: %s", shard, ec.message().c_str());
+    }
+}
+
+// Count the player on the shard that confirmed its room or queue
+void set_seat(Session& session, int shard, bool seated) {
+    if (session.seated) {
+        workers[session.home]->seated.fetch_sub(1, std::memory_order_relaxed);
+    }
+    session.home = shard;
+    session.seated = seated;
+    if (seated) {
+        workers[shard]->seated.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int least_loaded_shard() {
+    int best = 0;
+    for (size_t i = 1; i < workers.size(); ++i) {
+        if (workers[i]->seated.load(std::memory_order_relaxed) < workers[best]->seated.load(std::memory_order_relaxed)) {
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
+// Ask the shard of the current list request for the rest of its page
+void request_list_page(const session_ptr& session, const std::string& cursor) {
+    ListRequest& list = session->list;
+    forward(session, list.shard, "LIST_ROOMS " + list.filter + " " + cursor + " " + std::to_string(list.limit - list.rooms.size()));
+}
+
+// A shard answered the list request: move on to the next shard while the page has room,
+// then answer the player with one ROOM_LIST. The cursor is the last room id returned,
+// whose shard is where the next page starts.
+void collect_list_page(const session_ptr& session, const std::string& reply) {
+    ListRequest& list = session->list;
+    std::istringstream lines(reply);
+    std::string line, command, next;
+    size_t count = 0;
+    std::getline(lines, line);
+    std::istringstream header(line);
+    header >> command >> count >> next;
+    while (std::getline(lines, line)) {
+        list.rooms.push_back(line);
+    }
+
+    bool full = list.rooms.size() >= list.limit;
+    bool last_shard = list.shard + 1 >= static_cast<int>(workers.size());
+    if (next == "-" && !full && !last_shard) {
+        ++list.shard;
+        request_list_page(session, "-");
+        return;
+    }
+    std::string cursor = "-";
+    if (next != "-") {
+        cursor = next;
+    } else if (full && !last_shard) {
+        cursor = list.rooms.back().substr(0, list.rooms.back().find(' '));
+    }
+    std::string out = "ROOM_LIST " + std::to_string(list.rooms.size()) + " " + cursor;
+    for (const std::string& room : list.rooms) {
+        out += "\n" + room;
+    }
+    list = ListRequest();
+    websocketpp::lib::error_code ec = session->con->send(out, websocketpp::frame::opcode::text);
+    (void)ec;
+}
+
+void on_upstream_open(session_ptr session, int shard, connection_hdl) {
+    std::lock_guard<std::mutex> lock(session->mtx);
+    Upstream& up = session->upstreams[shard];
+    up.open = true;
+    if (session->closed) {
+        return;
+    }
+    for (const std::string& payload : up.pending) {
+        websocketpp::lib::error_code ec = up.con->send(payload, websocketpp::frame::opcode::text);
+        (void)ec;
+    }
+    up.pending.clear();
+}
+
+void on_upstream_message(session_ptr session, int shard, connection_hdl, message_ptr msg) {
+    std::lock_guard<std::mutex> lock(session->mtx);
+    if (session->closed) {
+        return;
+    }
+    const std::string& payload = msg->get_payload();
+    if (msg->get_opcode() == websocketpp::frame::opcode::text) {
+        std::string command = payload.substr(0, payload.find_first_of(" \n"));
+        if (command == "ROOM_LIST" && session->list.active && shard == session->list.shard) {
+            collect_list_page(session, payload);
+            return;
+        }
+        if (command == "ERROR" && session->list.active && shard == session->list.shard) {
+            session->list = ListRequest(); // The shard refused the page, the player gets its error
+        }
+        if ((command == "LOBBY_SUBSCRIBED" || command == "LOBBY_UNSUBSCRIBED") && shard != 0) {
+            return; // Every shard confirms, the player expects one answer
+        }
+        if (command == "ROOM_CREATED" || command == "ROOM_JOINED" || command == "SPECTATING" ||
+            command == "MATCH_QUEUED" || command == "MATCH_FOUND" || command == "RESUMED") {
+            set_seat(*session, shard, true);
+        } else if ((command == "ROOM_LEFT" || command == "ROOM_CLOSED" || command == "MATCH_CANCELLED") && shard == session->home) {
+            set_seat(*session, shard, false);
+        }
+    }
+    websocketpp::lib::error_code ec = session->con->send(payload, msg->get_opcode());
+    (void)ec;
+}
+
+void on_upstream_close(session_ptr session, int shard, connection_hdl) {
+    std::lock_guard<std::mutex> lock(session->mtx);
+    if (!session->closed) {
+        TRON_LOG(Info, "", 0, "Shard %d closed a player's connection", shard);
+        close_session(*session, "Shard closed the connection");
+    }
+}
+
+// Shard owning the first 64 bits of a RESUME token, as tron_server packs them
+int token_shard(const std::string& token) {
+    if (token.size() != 32 || token.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        return 0;
+    }
+    return tron_registry::shard_of(std::strtoull(token.substr(0, 16).c_str(), nullptr, 16), static_cast<int>(workers.size()));
+}
+
+void on_client_message(session_ptr session, connection_hdl, message_ptr msg) {
+    if (msg->get_opcode() != websocketpp::frame::opcode::text) {
+        return; // Players only send text commands
+    }
+    const std::string& payload = msg->get_payload();
+    std::istringstream ss(payload);
+    std::string command;
+    ss >> command;
+
+    std::lock_guard<std::mutex> lock(session->mtx);
+    if (session->closed) {
+        return;
+    }
+    session->last_activity = steady_clock::now();
+    if (command == "RTT") {
+        return; // The router's to send
+    }
+    int shards = static_cast<int>(workers.size());
+
+    if (command == "SUBSCRIBE_LOBBY" || command == "UNSUBSCRIBE_LOBBY") {
+        for (int shard = 0; shard < shards && !session->closed; ++shard) {
+            forward(session, shard, payload);
+        }
+        return;
+    }
+    if (command == "LIST_ROOMS") {
+        // LIST_ROOMS [all|open|started] [cursor or -] [limit], as tron_server takes it
+        std::string filter = "all", cursor = "-";
+        size_t limit = 20;
+        ss >> filter >> cursor >> limit;
+        tron_registry::room_key after = 0;
+        std::string error;
+        if (filter != "all" && filter != "open" && filter != "started") {
+            error = "ERROR Unknown room filter.";
+        } else if (cursor != "-" && !tron_registry::pack_room_id(cursor, after)) {
+            error = "ERROR Invalid cursor.";
+        } else if (session->list.active) {
+            error = "ERROR Room list already pending.";
+        }
+        if (!error.empty()) {
+            websocketpp::lib::error_code ec = session->con->send(error, websocketpp::frame::opcode::text);
+            (void)ec;
+            return;
+        }
+        session->list.active = true;
+        session->list.filter = filter;
+        session->list.limit = std::min<size_t>(std::max<size_t>(limit, 1), 100);
+        session->list.shard = cursor == "-" ? 0 : tron_registry::shard_of(after, shards);
+        request_list_page(session, cursor);
+        return;
+    }
+
+    int shard = session->home >= 0 ? session->home : 0;
+    if (!session->seated) {
+        // Commands that place the player: remember the shard right away, so that a
+        // START_GAME sent before ROOM_CREATED comes back goes to the same worker
+        std::string argument;
+        ss >> argument;
+        tron_registry::room_key key;
+        if (command == "CREATE_ROOM") {
+            shard = session->home = least_loaded_shard();
+        } else if (command == "JOIN_ROOM" || command == "SPECTATE") {
+            shard = session->home = tron_registry::pack_room_id(argument, key) ? tron_registry::shard_of(key, shards) : 0;
+        } else if (command == "QUICK_MATCH") {
+            shard = session->home = 0;
+            if (session->rtt_ms >= 0) {
+                forward(session, shard, "RTT " + std::to_string(session->rtt_ms));
+            }
+        } else if (command == "RESUME") {
+            shard = session->home = token_shard(argument);
+        }
+    }
+    forward(session, shard, payload);
+}
+
+// Ping the player with the send time in microseconds, on_client_pong times the answer
+void ping_player(Session& session) {
+    auto sent = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now().time_since_epoch());
+    websocketpp::lib::error_code ec;
+    session.con->ping(std::to_string(sent.count()), ec);
+}
+
+void on_client_pong(session_ptr session, connection_hdl, std::string payload) {
+    int64_t sent_us = std::strtoll(payload.c_str(), nullptr, 10);
+    steady_clock::time_point now = steady_clock::now();
+    int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    std::lock_guard<std::mutex> lock(session->mtx);
+    session->last_activity = now;
+    if (sent_us > 0 && now_us >= sent_us) {
+        session->rtt_ms = static_cast<int>((now_us - sent_us) / 1000);
+    }
+}
+
+void schedule_idle_check(const session_ptr& session, steady_clock::time_point at);
+
+// Ping a player silent for --idle-s, close it if it stayed silent since
+void check_idle(session_ptr session, websocketpp::lib::asio::error_code const & ec) {
+    if (ec) {
+        return; // Cancelled by close_session
+    }
+    std::lock_guard<std::mutex> lock(session->mtx);
+    if (session->closed) {
+        return;
+    }
+    steady_clock::time_point now = steady_clock::now();
+    steady_clock::time_point idle_until = session->last_activity + std::chrono::seconds(options.idle_s);
+    if (now < idle_until) {
+        session->idle_ping = false;
+        schedule_idle_check(session, idle_until);
+    } else if (!session->idle_ping) {
+        session->idle_ping = true;
+        ping_player(*session);
+        schedule_idle_check(session, now + idle_ping_wait);
+    } else {
+        TRON_LOG(Info, "", 0, "Closing idle connection");
+        close_session(*session, "Idle");
+    }
+}
+
+// Called with the session locked
+void schedule_idle_check(const session_ptr& session, steady_clock::time_point at) {
+    session->idle_timer->expires_at(at);
+    session->idle_timer->async_wait(bind(&check_idle, session, ::_1));
+}
+
+void on_client_close(session_ptr session, connection_hdl) {
+    std::lock_guard<std::mutex> lock(session->mtx);
+    close_session(*session, "");
+}
+
+// Offer the binary protocol to clients asking for it; upstreams ask the workers for it in turn
+bool on_validate(connection_hdl hdl) {
+    server::connection_ptr con = router.get_con_from_hdl(hdl);
+    for (const std::string& protocol : con->get_requested_subprotocols()) {
+        if (protocol == tron_protocol::SUBPROTOCOL) {
+            con->select_subprotocol(protocol);
+            break;
+        }
+    }
+    return true;
+}
+
+void on_open(connection_hdl hdl) {
+    server::connection_ptr con = router.get_con_from_hdl(hdl);
+    session_ptr session = std::make_shared<Session>();
+    session->con = con;
+    session->binary = con->get_subprotocol() == tron_protocol::SUBPROTOCOL;
+    session->upstreams.resize(workers.size());
+    session->last_activity = steady_clock::now();
+    con->set_message_handler(bind(&on_client_message, session, ::_1, ::_2));
+    con->set_close_handler(bind(&on_client_close, session, ::_1));
+    con->set_pong_handler(bind(&on_client_pong, session, ::_1, ::_2));
+
+    std::lock_guard<std::mutex> lock(session->mtx);
+    ping_player(*session); // The round trip is known by the time the player asks for a quick match
+    if (options.idle_s > 0) {
+        session->idle_timer.reset(new steady_timer(router.get_io_service()));
+        schedule_idle_check(session, session->last_activity + std::chrono::seconds(options.idle_s));
+    }
+}
+
+void spawn_worker(Worker& worker) {
+    std::vector<std::string> args = {options.server_path, "--shard",
+                                     std::to_string(worker.index) + "/" + std::to_string(workers.size()),
+                                     "--worker-port", std::to_string(worker.port)};
+    args.insert(args.end(), options.server_args.begin(), options.server_args.end());
+    // Built before forking, the child of a threaded process must not allocate
+    std::vector<char*> argv;
+    for (std::string& arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    if (pid < 0) {
+        TRON_LOG(Error, "", 0, "Cannot start shard %d", worker.index);
+        return;
+    }
+    worker.pid = pid;
+    TRON_LOG(Info, "", 0, "Shard %d started as process %d on port %d", worker.index, static_cast<int>(pid), worker.port);
+}
+
+// Wait until a worker accepts on its port, for at most about five seconds
+bool wait_for_worker(const Worker& worker) {
+    websocketpp::lib::asio::ip::tcp::endpoint endpoint(websocketpp::lib::asio::ip::address_v4::loopback(),
+                                                       static_cast<uint16_t>(worker.port));
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        websocketpp::lib::asio::error_code ec;
+        websocketpp::lib::asio::ip::tcp::socket socket(router.get_io_service());
+        socket.connect(endpoint, ec);
+        if (!ec) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return false;
+}
+
+// Reap workers that exited and start them again a second later
+void watch_workers(std::shared_ptr<websocketpp::lib::asio::signal_set> signals) {
+    signals->async_wait([signals](websocketpp::lib::asio::error_code const & ec, int) {
+        if (ec) {
+            return;
+        }
+        int status = 0;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (std::unique_ptr<Worker>& worker : workers) {
+                if (worker->pid != pid) continue;
+                worker->pid = -1;
+                if (stopping.load()) break;
+                TRON_LOG(Warn, "", 0, "Shard %d exited (status %d), restarting it", worker->index, status);
+                auto timer = std::make_shared<steady_timer>(router.get_io_service(), std::chrono::seconds(1));
+                Worker* restart = worker.get();
+                timer->async_wait([timer, restart](websocketpp::lib::asio::error_code const & ec) {
+                    if (!ec && !stopping.load()) {
+                        spawn_worker(*restart);
+                    }
+                });
+            }
+        }
+        watch_workers(signals);
+    });
+}
+
+int main(int argc, char* argv[]) {
+    tron_log::Logger& log = tron_log::logger();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--workers" && i + 1 < argc) {
+            options.workers = std::min(64, std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--port" && i + 1 < argc) {
+            options.port = std::atoi(argv[++i]);
+        } else if (arg == "--worker-port" && i + 1 < argc) {
+            options.worker_port = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--idle-s" && i + 1 < argc) {
+            options.idle_s = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--server" && i + 1 < argc) {
+            options.server_path = argv[++i];
+        } else if (arg == "--") {
+            options.server_args.assign(argv + i + 1, argv + argc);
+            break;
+        } else {
+            std::fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (options.worker_port == 0) {
+        options.worker_port = options.port + 1;
+    }
+    log.start();
+
+    try {
+        router.clear_access_channels(websocketpp::log::alevel::all);
+        upstream.clear_access_channels(websocketpp::log::alevel::all);
+        upstream.clear_error_channels(websocketpp::log::elevel::all);
+        router.init_asio();
+        upstream.init_asio(&router.get_io_service());
+
+        // Reap and restart workers; watched before the first fork so that no exit is missed
+        auto children = std::make_shared<websocketpp::lib::asio::signal_set>(router.get_io_service(), SIGCHLD);
+        watch_workers(children);
+        for (int i = 0; i < options.workers; ++i) {
+            workers.emplace_back(new Worker());
+            workers.back()->index = i;
+            workers.back()->port = options.worker_port + i;
+        }
+        for (std::unique_ptr<Worker>& worker : workers) {
+            spawn_worker(*worker);
+        }
+        for (std::unique_ptr<Worker>& worker : workers) {
+            if (!wait_for_worker(*worker)) {
+                TRON_LOG(Warn, "", 0, "Shard %d is not answering on port %d yet", worker->index, worker->port);
+            }
+        }
+
+        // Stop the workers with the router
+        websocketpp::lib::asio::signal_set shutdown(router.get_io_service(), SIGINT, SIGTERM);
+        shutdown.async_wait([](websocketpp::lib::asio::error_code const & ec, int) {
+            if (ec) {
+                return;
+            }
+            stopping.store(true);
+            websocketpp::lib::error_code ignored;
+            router.stop_listening(ignored);
+            for (std::unique_ptr<Worker>& worker : workers) {
+                if (worker->pid > 0) {
+                    kill(worker->pid, SIGTERM);
+                }
+            }
+            router.stop();
+        });
+
+        router.set_validate_handler(bind(&on_validate, ::_1));
+        router.set_open_handler(bind(&on_open, ::_1));
+        router.set_reuse_addr(true);
+        router.listen(static_cast<uint16_t>(options.port));
+        router.start_accept();
+        TRON_LOG(Info, "", 0, "Router started on port %d in front of %d shard(s)", options.port, options.workers);
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < options.threads; ++i) {
+            pool.emplace_back([]() { router.run(); });
+        }
+        router.run();
+        for (std::thread& t : pool) {
+            t.join();
+        }
+    } catch (websocketpp::exception const & e) {
+        TRON_LOG(Error, "", 0, "%s", e.what());
+    } catch (std::exception const & e) {
+        TRON_LOG(Error, "", 0, "%s", e.what());
+    }
+
+    for (std::unique_ptr<Worker>& worker : workers) {
+        if (worker->pid > 0) {
+            kill(worker->pid, SIGTERM);
+            waitpid(worker->pid, nullptr, 0);
+        }
+    }
+    log.stop();
+    return 0;
+}
@@ -1,255 +1,2258 @@
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
 
-#include <iostream>
-#include <set>
-#include <map>
 #include <string>
 #include <sstream>
 #include <random>
+#include <chrono>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <map>
+#include <set>
+#include <unordered_map>
 #include <algorithm> // For std::remove_if
 
-typedef websocketpp::server<websocketpp::config::asio> server;
+#include <unistd.h>
+
+#include "tron_bot.hpp"
+#include "tron_game.hpp"
+#include "tron_protocol.hpp"
+#include "tron_registry.hpp"
+#include "tron_metrics.hpp"
+#include "tron_log.hpp"
+#include "tron_record.hpp"
+#include "tron_results.hpp"
+#include "tron_timer.hpp"
+
+typedef websocketpp::server<websocketpp::config::asio> server;
+
+using websocketpp::lib::placeholders::_1;
+using websocketpp::lib::placeholders::_2;
+using websocketpp::lib::bind;
+
+// pull out the type of messages sent by our config
+typedef websocketpp::config::asio::message_type message_type;
+typedef message_type::ptr message_ptr;
+typedef websocketpp::connection_hdl connection_hdl;
+typedef websocketpp::lib::asio::steady_timer steady_timer;
+typedef websocketpp::lib::asio::io_service::strand strand;
+typedef server::connection_ptr connection_ptr;
+
+using tron_registry::conn_id;
+using tron_registry::room_key;
+
+// Arena size, must match the client (main.cpp)
+const int W = 60;
+const int H = 40;
+
+// Simulation tick interval in milliseconds (--tick-ms), same pace as the client's local delay
+int tick_interval_ms = 50;
+
+// Lobby tick (--lobby-ms): quick-match pairing and lobby diff flushes run at this period
+int lobby_interval_ms = 200;
+
+// Quick-match RTT bucket width in milliseconds (--match-rtt-ms), 0 pairs regardless of RTT.
+// Players left alone in their bucket for match_bucket_wait are paired with anyone.
+int match_rtt_bucket_ms = 0;
+const std::chrono::seconds match_bucket_wait(3);
+
+// Lag compensation (--rewind-ticks): an INPUT tagged with a tick at most this many ticks in
+// the past is applied at that tick and the match re-simulated from there. 0 applies every
+// input on the next tick. Inputs may be tagged at most max_input_lead ticks ahead.
+uint32_t rewind_ticks = 4;
+const uint32_t max_rewind_ticks = 16;
+const uint32_t max_input_lead = 16;
+
+// Server bots (ADD_BOT) decide on --bot-threads workers, 0 disables them. A bot searches
+// for at most --bot-budget-us per tick and its answer must be back before the next tick.
+int bot_threads = 1;
+int bot_budget_us = 1000;
+
+// Seconds a dropped player's seat stays reserved for RESUME (--resume-grace-s), 0 frees it at once
+int resume_grace_s = 10;
+
+// Outbound budget per connection, on the bytes websocketpp has queued for it. Past
+// --send-budget-kb a client gets no more state ticks until it drains, then a keyframe;
+// past --send-limit-kb it is disconnected and nothing more is queued for it.
+size_t send_budget_bytes = 64 * 1024;
+size_t send_limit_bytes = 1024 * 1024;
+
+// Worker of a tron_router (--shard I/N, --worker-port P): listens on 127.0.0.1:P instead of
+// port 9002 and only creates room ids and resume tokens that the router maps to shard I.
+// The router pings the players and passes their RTT on with RTT <ms>, since pings from
+// here would only time the hop to the router.
+int shard_index = 0;
+int shard_count = 1;
+int worker_port = 0;
+
+// Idle timeouts in seconds, 0 disables each. A room is closed after --lobby-idle-s without
+// a roster or settings change while nobody has started it, or --finished-idle-s after its
+// match ended. A connection that sent nothing for --idle-s gets a websocket ping and is
+// closed if the pong is not back within idle_ping_wait_ms.
+int lobby_idle_s = 300;
+int finished_idle_s = 60;
+int connection_idle_s = 120;
+const int64_t idle_ping_wait_ms = 10000;
+
+// A connection taking part in a room. Holding the connection pointer lets the room send
+// without locking the connection handle.
+struct RoomPlayer {
+    conn_id id;
+    connection_ptr con;
+    bool binary; // Receives state as tron_protocol frames
+    bool bot = false; // Server bot, has no connection
+    std::string token;  // Resume token of a seated player
+    bool away = false;  // Connection dropped, seat kept until grace_timer fires
+    std::shared_ptr<steady_timer> grace_timer;
+    bool behind = false; // Missed state ticks over its send budget, owes a keyframe
+
+    RoomPlayer(conn_id id, connection_ptr con, bool binary, bool bot = false)
+        : id(id), con(con), binary(binary), bot(bot) {}
+};
+
+// Room structure. Everything below is only touched from handlers running on room_strand.
+struct Room {
+    room_key key;
+    std::string id; // key unpacked, as shown to players
+    std::string name;
+    std::vector<RoomPlayer> players;
+    std::vector<RoomPlayer> spectators;                // Unbounded, receive everything players do
+    std::unordered_map<conn_id, size_t> spectator_slot; // Index into spectators
+    bool game_started = false;
+    bool closed = false; // Set once the room has been removed from active_rooms
+    bool quick_match = false; // Made by the matcher, cannot be joined by id
+    conn_id creator;
+    int max_players = 2; // 2 to tron_game::MAX_PLAYERS, set with SET_ROOM
+    bool lockstep = false; // SET_ROOM mode lockstep: clients simulate, ticks carry only the turns
+
+    // Serializes the room's message handlers and its tick timer
+    strand room_strand;
+
+    // Match state, only meaningful while game_started is true
+    tron_game::Match game;
+    conn_id slot_ids[tron_game::MAX_PLAYERS] = {0}; // players[i] drives slot i, 0 once it left
+
+    // Turns and states of the last HISTORY ticks, by tick % HISTORY. A turn slot belongs to
+    // tick t only while its tick field is t. This bounds the rewind window and the lead.
+    static const uint32_t HISTORY = 64;
+    struct TurnSlot {
+        uint32_t tick = 0;
+        int dir = -1;
+    };
+    struct TickState {
+        tron_game::Player players[tron_game::MAX_PLAYERS];
+    };
+    TurnSlot turns[tron_game::MAX_PLAYERS][HISTORY];
+    TickState history[HISTORY];            // Heads after each tick, history[0] is the start
+    uint32_t rewind_from = 0;              // Earliest tick a late input landed on, 0 when none
+    bool resync = false;                   // The last tick was corrected, send a full state
+    uint32_t forfeited = 0;                // Slots that left since the last tick went out, bit per slot
+    uint32_t recorded_tick = 0;            // Last tick handed to the recording
+    std::vector<int> bot_slots;            // Slots played by server bots
+    uint32_t match_serial = 0;             // Tells bot answers for an earlier match apart
+    int64_t match_start_ms = 0;            // Unix time the match started
+    std::shared_ptr<steady_timer> tick_timer;
+    std::chrono::steady_clock::time_point next_tick;
+    uint32_t tick = 0;
+    std::shared_ptr<tron_record::Recording> recording; // Set while a recorded match runs
+
+    // Uptime in ms past which the room is idle, NEVER while a match runs. Written on the
+    // strand, read by the reaper on the lobby tick.
+    std::atomic<int64_t> idle_deadline_ms{NEVER};
+    static constexpr int64_t NEVER = INT64_MAX;
+
+    Room(websocketpp::lib::asio::io_service& io, std::string room_name)
+        : key(tron_registry::NO_ROOM), name(room_name), creator(0), room_strand(io), game(W, H) {}
+
+    Room(websocketpp::lib::asio::io_service& io, std::string room_name, RoomPlayer creator)
+        : Room(io, room_name) {
+        this->creator = creator.id;
+        players.push_back(creator);
+    }
+};
+
+typedef std::shared_ptr<Room> room_ptr;
+
+// Per-connection state
+struct Client {
+    connection_ptr con;
+    room_key room = tron_registry::NO_ROOM; // Room the connection is in or joining
+    bool binary = false;                    // Negotiated tron_protocol::SUBPROTOCOL
+    bool queued = false;                    // Waiting in the quick-match queue
+    uint32_t match_ticket = 0;              // Bumped on every QUICK_MATCH, tells stale queue entries apart
+    int rtt_ms = -1;                        // Measured by a websocket ping on QUICK_MATCH, or from the router; -1 until known
+    int64_t last_activity = 0;              // Uptime in ms of the last message or pong
+    bool idle_ping = false;                 // Pinged by the reaper for being silent
+};
+
+// Global registries for managing rooms and connections
+tron_registry::ShardedTable<room_key, room_ptr> active_rooms;
+tron_registry::ShardedTable<conn_id, Client> clients;
+tron_registry::ConnectionIds connection_ids;
+// Resume tokens by their first 64 bits, to the room holding the seat
+tron_registry::ShardedTable<uint64_t, room_key> resume_tokens;
+
+// Writes finished and running matches to --record-dir, if given
+tron_record::Recorder recorder;
+tron_bot::WorkerPool bot_pool;
+tron_results::ResultStore results;
+
+// Instrumentation exported on /metrics
+struct ServerMetrics {
+    tron_metrics::Counter messages_in, bytes_in;
+    tron_metrics::Counter messages_out, bytes_out;
+    tron_metrics::Gauge started_rooms;
+    tron_metrics::Gauge spectators;
+    tron_metrics::Gauge match_queue;            // Players waiting for a quick match
+    tron_metrics::Gauge away_players;           // Seats kept for a RESUME
+    tron_metrics::Counter resumes, resume_expired;
+    tron_metrics::Counter ticks_dropped, catchup_keyframes, slow_closes; // Send budget
+    tron_metrics::Gauge idle_tracked;           // Rooms and connections on the reaper's wheel
+    tron_metrics::Counter idle_rooms_closed, idle_connections_closed;
+    tron_metrics::Counter quick_matches;
+    tron_metrics::Counter rewinds, rewound_ticks; // Late inputs applied at their tick
+    tron_metrics::Counter bot_decisions, bot_skipped; // Skipped: no worker got to it before the next tick
+    tron_metrics::Histogram bot_decision_time;
+    tron_metrics::Histogram tick_time;          // Simulation step of one room
+    tron_metrics::Histogram broadcast_latency;  // Tick deadline until the state is queued to every player
+} metrics;
+
+// Lobby directory behind LIST_ROOMS and SUBSCRIBE_LOBBY. Rooms publish their summary
+// from their own strand whenever it changes; the directory keeps the summaries ordered by
+// key for paging and queues one LOBBY_* line per change. flush() runs on the lobby tick
+// and sends everything queued since the last one as a single message per subscriber, so
+// a change costs O(log rooms) and a flush one send per subscriber, however many rooms
+// exist or changed.
+//
+// Subscribers should send SUBSCRIBE_LOBBY before the first LIST_ROOMS so that no change
+// falls between the two; diffs for rooms a client already knows are idempotent.
+class Lobby {
+public:
+    enum Filter { All, Open, Started };
+
+    // Record the current state of a room and announce it if anything visible changed
+    void publish(const Room& room) {
+        Summary summary{room.id, trim_name(room.name), static_cast<int>(room.players.size()),
+                        room.max_players, room.game_started};
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = rooms.find(room.key);
+        if (it == rooms.end()) {
+            queue_diff("LOBBY_ADD " + format(summary));
+        } else if (it->second.players != summary.players || it->second.max_players != summary.max_players ||
+                   it->second.started != summary.started) {
+            queue_diff("LOBBY_UPDATE " + summary.id + " " + std::to_string(summary.players) + " " +
+                       std::to_string(summary.max_players) + " " + state_name(summary));
+        } else {
+            return;
+        }
+        index(room.key, summary);
+        rooms[room.key] = summary;
+    }
+
+    void remove(const Room& room) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (rooms.erase(room.key) == 0) {
+            return;
+        }
+        open_rooms.erase(room.key);
+        started_rooms.erase(room.key);
+        queue_diff("LOBBY_REMOVE " + room.id);
+    }
+
+    // Send the diffs queued since the last flush, one line each, in a single message
+    void flush() {
+        std::string diffs;
+        std::shared_ptr<const std::vector<connection_ptr>> targets;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending.empty()) {
+                return;
+            }
+            diffs.swap(pending);
+            targets = subscribers_snapshot;
+        }
+        broadcast(targets, diffs);
+    }
+
+    // One page of the directory as a ROOM_LIST reply:
+    //   ROOM_LIST <count> <next cursor or ->
+    //   <id> <players> <max players> <open|full|started> <name>   (one line per room)
+    // Pages resume after the cursor, so rooms created or closed meanwhile never shift them.
+    std::string list(Filter filter, room_key after, size_t limit) {
+        std::vector<Summary> page;
+        bool more = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (filter == All) {
+                collect(rooms, after, limit, page, more, [](const std::pair<const room_key, Summary>& entry) { return entry.second; });
+            } else {
+                const std::set<room_key>& keys = filter == Open ? open_rooms : started_rooms;
+                collect(keys, after, limit, page, more, [&](room_key key) { return rooms.at(key); });
+            }
+        }
+        std::string reply = "ROOM_LIST " + std::to_string(page.size()) + " " + (more ? page.back().id : "-");
+        for (const Summary& summary : page) {
+            reply += "\n" + format(summary);
+        }
+        return reply;
+    }
+
+    void subscribe(conn_id id, const connection_ptr& con) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (subscribers.emplace(id, con).second) {
+            refresh_snapshot();
+        }
+    }
+
+    void unsubscribe(conn_id id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (subscribers.erase(id) != 0) {
+            refresh_snapshot();
+        }
+    }
+
+    size_t subscriber_count() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return subscribers.size();
+    }
+
+private:
+    struct Summary {
+        std::string id;
+        std::string name;
+        int players;
+        int max_players;
+        bool started;
+    };
+
+    static std::string trim_name(const std::string& name) {
+        size_t start = name.find_first_not_of(" \t");
+        return start == std::string::npos ? "" : name.substr(start);
+    }
+
+    static const char* state_name(const Summary& summary) {
+        if (summary.started) return "started";
+        return summary.players < summary.max_players ? "open" : "full";
+    }
+
+    static std::string format(const Summary& summary) {
+        return summary.id + " " + std::to_string(summary.players) + " " + std::to_string(summary.max_players) + " " +
+               state_name(summary) + " " + summary.name;
+    }
+
+    // Keep the open/started key sets in step with a room's new summary
+    void index(room_key key, const Summary& summary) {
+        if (!summary.started && summary.players < summary.max_players) {
+            open_rooms.insert(key);
+        } else {
+            open_rooms.erase(key);
+        }
+        if (summary.started) {
+            started_rooms.insert(key);
+        } else {
+            started_rooms.erase(key);
+        }
+    }
+
+    // Up to limit entries with a key after the cursor
+    template <typename Container, typename Get>
+    static void collect(const Container& container, room_key after, size_t limit,
+                        std::vector<Summary>& page, bool& more, Get get) {
+        auto it = after == tron_registry::NO_ROOM ? container.begin() : container.upper_bound(after);
+        for (; it != container.end() && page.size() < limit; ++it) {
+            page.push_back(get(*it));
+        }
+        more = it != container.end();
+    }
+
+    // Diffs are only worth keeping while someone listens
+    void queue_diff(const std::string& diff) {
+        if (subscribers.empty()) {
+            return;
+        }
+        if (!pending.empty()) {
+            pending += '\n';
+        }
+        pending += diff;
+    }
+
+    // Rebuilt on (un)subscribe so that a flush only copies a pointer under the lock
+    void refresh_snapshot() {
+        auto snapshot = std::make_shared<std::vector<connection_ptr>>();
+        snapshot->reserve(subscribers.size());
+        for (const auto& entry : subscribers) {
+            snapshot->push_back(entry.second);
+        }
+        subscribers_snapshot = snapshot;
+    }
+
+    static void broadcast(const std::shared_ptr<const std::vector<connection_ptr>>& targets, const std::string& diff);
+
+    std::mutex mutex;
+    std::map<room_key, Summary> rooms;            // Ordered by key, the paging cursor
+    std::set<room_key> open_rooms, started_rooms;  // Keys matching each LIST_ROOMS filter
+    std::map<conn_id, connection_ptr> subscribers;
+    std::shared_ptr<const std::vector<connection_ptr>> subscribers_snapshot;
+    std::string pending; // Diffs queued since the last flush
+};
+
+Lobby lobby;
+
+// A QUICK_MATCH request waiting for an opponent
+struct QueuedPlayer {
+    conn_id id;
+    uint32_t ticket; // Client::match_ticket when queued
+    std::chrono::steady_clock::time_point queued_at;
+    int bucket;      // RTT bucket, filled in by the matcher
+};
+
+// Handoff from message handlers to a job on the lobby tick. Handlers only append; the
+// job takes everything that arrived since its last tick with a single swap.
+template <typename T>
+class LobbyQueue {
+public:
+    void push(const T& item) {
+        std::lock_guard<std::mutex> lock(mutex);
+        incoming.push_back(item);
+    }
+
+    void take(std::vector<T>& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out.insert(out.end(), incoming.begin(), incoming.end());
+        incoming.clear();
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<T> incoming;
+};
+
+LobbyQueue<QueuedPlayer> match_queue;
+
+// Something the reaper watches for idleness: a connection, or a room when id is 0
+struct Reapable {
+    conn_id id;
+    room_key room;
+};
+
+LobbyQueue<Reapable> reap_queue;
+
+// Milliseconds since the server started, the clock of the idle timeouts
+int64_t uptime_ms() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Restart a room's idle clock with the given timeout, or stop it (0 or a running match)
+void set_room_idle(Room& room, int timeout_s) {
+    room.idle_deadline_ms.store(timeout_s > 0 && !room.game_started ? uptime_ms() + timeout_s * 1000LL : Room::NEVER,
+                                std::memory_order_relaxed);
+}
+
+// Hand a new room or connection to the reaper, if its kind has a timeout
+void track_idle(const Reapable& item) {
+    if (item.id != 0 ? connection_idle_s > 0 : lobby_idle_s > 0 || finished_idle_s > 0) {
+        reap_queue.push(item);
+    }
+}
+
+// Function to generate a random room key, one per possible 6-char room ID
+room_key generate_room_key() {
+    thread_local std::mt19937 generator(std::random_device{}());
+    std::uniform_int_distribution<room_key> distribution(0, tron_registry::ROOM_KEY_COUNT - 1);
+    room_key key;
+    do {
+        key = distribution(generator);
+    } while (tron_registry::shard_of(key, shard_count) != shard_index);
+    return key;
+}
+
+// Disconnect a client holding more than send_limit_bytes unsent. Returns true when
+// nothing more should be queued for it.
+bool over_send_limit(const connection_ptr& con) {
+    size_t queued = con->get_buffered_amount();
+    if (queued <= send_limit_bytes) {
+        return false;
+    }
+    websocketpp::lib::error_code ec;
+    con->close(websocketpp::close::status::policy_violation, "Too far behind", ec);
+    if (!ec) { // Not closing already
+        metrics.slow_closes.add();
+        TRON_LOG(Warn, "", 0, "Closing connection with %zu bytes unsent", queued);
+    }
+    return true;
+}
+
+// Function to send a message to a specific player
+void send_message_to_player(const connection_ptr& con, const std::string& msg) {
+    if (!con || over_send_limit(con)) {
+        return; // Server bot, player away or connection too far behind
+    }
+    websocketpp::lib::error_code ec = con->send(msg, websocketpp::frame::opcode::text);
+    if (ec) {
+        TRON_LOG(Warn, "", 0, "Error sending message to player: %s", ec.message().c_str());
+        return;
+    }
+    metrics.messages_out.add();
+    metrics.bytes_out.add(msg.size());
+}
+
+// Serialize a payload once into a complete websocket frame. websocketpp queues prepared
+// messages as they are, without copying the payload or framing it again, and frames from
+// the server are never masked, so one message can go to any number of connections.
+message_ptr prepare_message(std::string payload, websocketpp::frame::opcode::value opcode) {
+    message_ptr msg = std::make_shared<message_type>(message_type::con_msg_man_ptr(), opcode, 0);
+    msg->set_header(websocketpp::frame::prepare_header(
+        websocketpp::frame::basic_header(opcode, payload.size(), true, false),
+        websocketpp::frame::extended_header(payload.size())));
+    msg->get_raw_payload().swap(payload);
+    msg->set_prepared(true);
+    return msg;
+}
+
+// Queue a prepared message on one connection
+void send_prepared(const connection_ptr& con, const message_ptr& msg) {
+    if (!con || over_send_limit(con)) {
+        return; // Server bot, player away or connection too far behind
+    }
+    websocketpp::lib::error_code ec = con->send(msg);
+    if (ec) {
+        TRON_LOG(Warn, "", 0, "Error sending to connection: %s", ec.message().c_str());
+        return;
+    }
+    metrics.messages_out.add();
+    metrics.bytes_out.add(msg->get_payload().size());
+}
+
+void Lobby::broadcast(const std::shared_ptr<const std::vector<connection_ptr>>& targets, const std::string& diff) {
+    if (!targets) {
+        return;
+    }
+    message_ptr prepared = prepare_message(diff, websocketpp::frame::opcode::text);
+    for (const connection_ptr& con : *targets) {
+        send_prepared(con, prepared);
+    }
+}
+
+// Function to send a message to all players and spectators in a room, framed once
+void send_message_to_room(Room& room, const std::string& msg) {
+    message_ptr prepared = prepare_message(msg, websocketpp::frame::opcode::text);
+    for (const RoomPlayer& player : room.players) {
+        send_prepared(player.con, prepared);
+    }
+    for (const RoomPlayer& spectator : room.spectators) {
+        send_prepared(spectator.con, prepared);
+    }
+}
+
+void send_room_update(Room& room) {
+    set_room_idle(room, lobby_idle_s);
+    send_message_to_room(room, "ROOM_UPDATE " + room.id + " " + std::to_string(room.players.size()) + " " +
+                         std::to_string(room.max_players) + (room.lockstep ? " lockstep" : " state"));
+}
+
+// Ticks that carry a full keyframe, on the wire and in recordings
+bool is_keyframe_tick(uint32_t tick) {
+    return (tick - 1) % tron_protocol::KEYFRAME_INTERVAL == 0;
+}
+
+// Heads as tron_protocol sends them
+std::vector<tron_protocol::Head> encode_heads(const tron_game::Player* players, size_t count) {
+    std::vector<tron_protocol::Head> heads(count);
+    for (size_t slot = 0; slot < count; ++slot) {
+        heads[slot] = {players[slot].x, players[slot].y, players[slot].dir, players[slot].alive};
+    }
+    return heads;
+}
+
+// The current state as a tron_protocol frame
+std::string encode_state_frame(Room& room, bool keyframe) {
+    std::vector<tron_protocol::Head> heads = encode_heads(room.game.players.data(), room.game.players.size());
+    if (keyframe) {
+        return tron_protocol::encode_keyframe(room.tick, W, H, heads,
+            [&](int x, int y) { return room.game.arena.owner(x, y); });
+    }
+    return tron_protocol::encode_delta(room.tick, W, heads);
+}
+
+// A lockstep tick: the direction every player moved in and the checksum of the result
+std::string encode_step_frame(Room& room) {
+    std::vector<int> dirs;
+    dirs.reserve(room.game.players.size());
+    for (const tron_game::Player& p : room.game.players) {
+        dirs.push_back(p.dir);
+    }
+    return tron_protocol::encode_step(room.tick, dirs, room.game.checksum(), room.forfeited);
+}
+
+// The same as a text line: STEP <tick> <one digit per player> <checksum in hex>, then
+// the slots that left before the tick as a hex bit mask when there are any
+std::string encode_text_step(Room& room) {
+    std::string out = "STEP " + std::to_string(room.tick) + " ";
+    for (const tron_game::Player& p : room.game.players) {
+        out += static_cast<char>('0' + p.dir);
+    }
+    char checksum[10];
+    std::snprintf(checksum, sizeof(checksum), " %08x", room.game.checksum());
+    out += checksum;
+    if (room.forfeited != 0) {
+        char forfeited[10];
+        std::snprintf(forfeited, sizeof(forfeited), " %x", room.forfeited);
+        out += forfeited;
+    }
+    return out;
+}
+
+// Heads of the text protocol, "x y dir" per player, -1 -1 for players out of the match
+std::string encode_text_heads(Room& room) {
+    std::string out;
+    for (const tron_game::Player& p : room.game.players) {
+        out += p.alive ? " " + std::to_string(p.x) + " " + std::to_string(p.y) : std::string(" -1 -1");
+        out += " " + std::to_string(p.dir);
+    }
+    return out;
+}
+
+// The full state as a text line for clients without the binary protocol:
+// KEYFRAME <tick> <heads> followed by the owner map as row-major <owner>:<run length> pairs
+std::string encode_text_keyframe(Room& room) {
+    std::string out = "KEYFRAME " + std::to_string(room.tick) + encode_text_heads(room);
+    const tron_game::Arena& arena = room.game.arena;
+    int owner = arena.owner(0, 0), run = 0;
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            if (arena.owner(x, y) != owner) {
+                out += " " + std::to_string(owner) + ":" + std::to_string(run);
+                owner = arena.owner(x, y);
+                run = 0;
+            }
+            ++run;
+        }
+    }
+    out += " " + std::to_string(owner) + ":" + std::to_string(run);
+    return out;
+}
+
+// Send the state of the current tick to everyone in the room, as a binary frame to
+// clients that negotiated the binary protocol and as a text TICK <heads> <tick> line to
+// the others. Each encoding is built and framed at most once per tick and shared by the
+// whole audience, so the tick allocates the same whatever the number of spectators.
+// After a rewind the tick goes out as a keyframe so that every client drops the
+// trail cells the correction took back.
+// Lockstep rooms send STEP instead: clients run the match themselves from the turns and
+// ask for a keyframe with RESYNC when their checksum disagrees, so a tick costs a few
+// bytes whatever the arena size and periodic keyframes are left out. A player leaving
+// does not show in the turns, so the STEP after it names the slots that left.
+// A viewer with more than send_budget_bytes queued skips ticks: each one is superseded by
+// the next, so instead of queueing them it gets a keyframe once it is under budget again,
+// and a stalled connection holds at most the budget plus one frame of state.
+void send_state_to_room(Room& room) {
+    bool keyframe = room.resync || (!room.lockstep && is_keyframe_tick(room.tick));
+    message_ptr text, frame, text_keyframe, frame_keyframe;
+    auto send_state = [&](RoomPlayer& viewer) {
+        if (!viewer.con) {
+            return; // Bot or player away
+        }
+        if (viewer.con->get_buffered_amount() > send_budget_bytes) {
+            viewer.behind = true;
+            metrics.ticks_dropped.add();
+            return;
+        }
+        bool catch_up = viewer.behind;
+        if (catch_up) {
+            viewer.behind = false;
+            metrics.catchup_keyframes.add();
+        }
+        if (viewer.binary) {
+            if (keyframe || !catch_up) {
+                if (!frame) {
+                    frame = prepare_message(room.lockstep && !keyframe ? encode_step_frame(room) : encode_state_frame(room, keyframe),
+                                            websocketpp::frame::opcode::binary);
+                }
+                send_prepared(viewer.con, frame);
+            } else {
+                if (!frame_keyframe) {
+                    frame_keyframe = prepare_message(encode_state_frame(room, true), websocketpp::frame::opcode::binary);
+                }
+                send_prepared(viewer.con, frame_keyframe);
+            }
+        } else {
+            if (room.resync || catch_up) {
+                if (!text_keyframe) {
+                    text_keyframe = prepare_message(encode_text_keyframe(room), websocketpp::frame::opcode::text);
+                }
+                send_prepared(viewer.con, text_keyframe);
+            } else {
+                if (!text) {
+                    text = prepare_message(room.lockstep ? encode_text_step(room) :
+                                           "TICK" + encode_text_heads(room) + " " + std::to_string(room.tick),
+                                           websocketpp::frame::opcode::text);
+                }
+                send_prepared(viewer.con, text);
+            }
+        }
+    };
+    for (RoomPlayer& player : room.players) {
+        send_state(player);
+    }
+    for (RoomPlayer& spectator : room.spectators) {
+        send_state(spectator);
+    }
+    room.resync = false;
+    room.forfeited = 0;
+}
+
+// Place every player at its start position on an empty arena
+void reset_match(Room& room) {
+    int count = static_cast<int>(room.players.size());
+    room.game.reset(count);
+    for (int slot = 0; slot < count; ++slot) {
+        for (Room::TurnSlot& turn : room.turns[slot]) {
+            turn = Room::TurnSlot();
+        }
+    }
+    std::copy(room.game.players.begin(), room.game.players.end(), room.history[0].players);
+    room.rewind_from = 0;
+    room.resync = false;
+    room.forfeited = 0;
+    room.recorded_tick = 0;
+}
+
+// Queue a turn for the tick the client meant it for. A tick still inside the rewind
+// window is corrected on the next tick; untagged, older or implausibly early turns
+// apply on the next tick. A tick holds one turn per player, a second one moves to the
+// tick after, as quick double turns did when inputs were applied one per tick.
+void queue_input(Room& room, int slot, int dir, uint32_t tick) {
+    uint32_t next = room.tick + 1;
+    uint32_t oldest = next > rewind_ticks ? next - rewind_ticks : 1;
+    if (tick < oldest || tick > next + max_input_lead) {
+        tick = next;
+    }
+    while (room.turns[slot][tick % Room::HISTORY].tick == tick) {
+        if (++tick > next + max_input_lead) {
+            return; // Flooding turns
+        }
+    }
+    room.turns[slot][tick % Room::HISTORY] = {tick, dir};
+    if (tick < next && (room.rewind_from == 0 || tick < room.rewind_from)) {
+        room.rewind_from = tick;
+    }
+}
+
+// Advance a running match from tick t - 1 to tick t with the turns queued for t.
+// Returns the result text once the match is decided, or an empty string while it goes on.
+std::string step_match(Room& room, uint32_t t) {
+    size_t count = room.game.players.size();
+    for (size_t slot = 0; slot < count; ++slot) {
+        const Room::TurnSlot& turn = room.turns[slot][t % Room::HISTORY];
+        if (turn.tick == t) {
+            room.game.turn(static_cast<int>(slot), turn.dir);
+        }
+    }
+    bool running = room.game.step();
+    std::copy(room.game.players.begin(), room.game.players.end(), room.history[t % Room::HISTORY].players);
+    return running ? "" : room.game.result();
+}
+
+// Take back ticks from..room.tick and simulate them again with the turns that arrived
+// late. A tick marks exactly the head cells of the players alive after it, so undoing
+// a tick is clearing them. Players who left stay out. Returns the result if the
+// corrected match ends, room.tick then being the last tick before the end.
+std::string rewind_match(Room& room, uint32_t from) {
+    size_t count = room.game.players.size();
+    for (uint32_t t = from; t <= room.tick; ++t) {
+        const Room::TickState& state = room.history[t % Room::HISTORY];
+        for (size_t slot = 0; slot < count; ++slot) {
+            if (state.players[slot].alive) {
+                room.game.arena.clear(state.players[slot].x, state.players[slot].y);
+            }
+        }
+    }
+    const Room::TickState& start = room.history[(from - 1) % Room::HISTORY];
+    std::copy(start.players, start.players + count, room.game.players.begin());
+    for (size_t slot = 0; slot < count; ++slot) {
+        if (room.slot_ids[slot] == 0) {
+            room.game.eliminate(static_cast<int>(slot));
+        }
+    }
+    for (uint32_t t = from; t <= room.tick; ++t) {
+        std::string result = step_match(room, t);
+        if (!result.empty()) {
+            room.tick = t - 1;
+            return result;
+        }
+    }
+    return "";
+}
+
+// Hand ticks up to last to the recording. Ticks are only recorded once they left the
+// rewind window, so the recording never holds a tick that was corrected afterwards.
+// Frames are rebuilt from the history; a keyframe leaves out the cells marked after it.
+void record_ticks(Room& room, uint32_t last) {
+    size_t count = room.game.players.size();
+    for (uint32_t t = room.recorded_tick + 1; t <= last; ++t) {
+        const Room::TickState& state = room.history[t % Room::HISTORY];
+        const Room::TickState& previous = room.history[(t - 1) % Room::HISTORY];
+        std::vector<uint8_t> inputs(count);
+        for (size_t slot = 0; slot < count; ++slot) {
+            int dir = state.players[slot].dir;
+            inputs[slot] = static_cast<uint8_t>(dir != previous.players[slot].dir ? dir : tron_record::NO_INPUT);
+        }
+        std::vector<tron_protocol::Head> heads = encode_heads(state.players, count);
+        bool keyframe = is_keyframe_tick(t);
+        std::string encoded;
+        if (keyframe) {
+            std::vector<int> later_cells;
+            for (uint32_t later = t + 1; later <= room.tick; ++later) {
+                const Room::TickState& after = room.history[later % Room::HISTORY];
+                for (size_t slot = 0; slot < count; ++slot) {
+                    if (after.players[slot].alive) {
+                        later_cells.push_back(after.players[slot].y * W + after.players[slot].x);
+                    }
+                }
+            }
+            encoded = tron_protocol::encode_keyframe(t, W, H, heads, [&](int x, int y) {
+                int owner = room.game.arena.owner(x, y);
+                if (owner != 0 && std::find(later_cells.begin(), later_cells.end(), y * W + x) != later_cells.end()) {
+                    return 0;
+                }
+                return owner;
+            });
+        } else {
+            encoded = tron_protocol::encode_delta(t, W, heads);
+        }
+        // Only queued here, the recorder's thread does the writing
+        room.recording->append_tick(t, inputs, encoded, keyframe);
+    }
+    room.recorded_tick = std::max(room.recorded_tick, last);
+}
+
+// Stop the simulation of a room and tell everyone in it who won
+void end_match(Room& room, const std::string& winner) {
+    room.game_started = false;
+    metrics.started_rooms.add(-1);
+    set_room_idle(room, finished_idle_s);
+    if (room.tick_timer) {
+        room.tick_timer->cancel();
+        room.tick_timer.reset();
+    }
+    send_message_to_room(room, "GAME_OVER " + winner);
+    lobby.publish(room);
+    if (room.recording) {
+        record_ticks(room, room.tick);
+        room.recording->finish(room.tick, winner);
+        room.recording.reset();
+    }
+    if (results.enabled()) {
+        tron_results::MatchResult result;
+        result.room_id = room.id;
+        result.finished_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        result.duration_ms = result.finished_ms - room.match_start_ms;
+        result.ticks = room.tick;
+        result.players = static_cast<int>(room.game.players.size());
+        result.bots = static_cast<int>(room.bot_slots.size());
+        result.result = winner;
+        for (int slot = 0; slot < result.players; ++slot) {
+            bool bot = std::find(room.bot_slots.begin(), room.bot_slots.end(), slot) != room.bot_slots.end();
+            result.lineup += (slot ? "," : "") + (bot ? std::string("bot") : std::to_string(room.slot_ids[slot]));
+            if (room.game.players[slot].alive && room.game.alive_count() == 1) {
+                result.winner = slot;
+            }
+        }
+        results.submit(std::move(result));
+    }
+    TRON_LOG(Info, room.id, 0, "Game over: %s", winner.c_str());
+}
+
+void schedule_tick(server* s, room_ptr room);
+
+// Hand the state of the tick just broadcast to the bot workers. Their turns come back on
+// the room strand for the next tick. The tick never waits for them: a bot whose answer
+// is late, or that no worker reached in time, keeps going straight.
+void plan_bots(room_ptr room) {
+    std::vector<int> slots;
+    for (int slot : room->bot_slots) {
+        if (room->game.players[slot].alive) {
+            slots.push_back(slot);
+        }
+    }
+    if (slots.empty()) {
+        return;
+    }
+    auto match = std::make_shared<tron_game::Match>(room->game);
+    uint32_t tick = room->tick, serial = room->match_serial;
+    // Leave a quarter of the tick to get the answers back onto the strand
+    auto expires = room->next_tick + std::chrono::milliseconds(tick_interval_ms * 3 / 4);
+    bool queued = bot_pool.submit([room, match, slots, tick, serial, expires]() {
+        thread_local tron_bot::Planner planner;
+        std::vector<std::pair<int, int>> turns;
+        for (int slot : slots) {
+            auto start = std::chrono::steady_clock::now();
+            if (start >= expires) {
+                metrics.bot_skipped.add();
+                continue;
+            }
+            int dir = planner.choose(*match, slot, std::min(expires, start + std::chrono::microseconds(bot_budget_us)));
+            metrics.bot_decisions.add();
+            metrics.bot_decision_time.observe_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+            if (dir != match->players[slot].dir) {
+                turns.emplace_back(slot, dir);
+            }
+        }
+        if (turns.empty()) {
+            return;
+        }
+        room->room_strand.post([room, turns, tick, serial]() {
+            if (!room->game_started || room->match_serial != serial) {
+                return;
+            }
+            // Meant for tick + 1; if that has gone by, the next tick rather than a rewind
+            for (const std::pair<int, int>& turn : turns) {
+                queue_input(*room, turn.first, turn.second, std::max(tick, room->tick) + 1);
+            }
+        });
+    });
+    if (!queued) {
+        metrics.bot_skipped.add(slots.size());
+    }
+}
+
+// Runs on the room strand
+void on_tick(server* s, room_ptr room, std::shared_ptr<steady_timer> timer,
+             websocketpp::lib::asio::error_code const & ec) {
+    if (ec || room->closed || room->tick_timer != timer) {
+        return; // Timer cancelled, the match ended or the room closed
+    }
+
+    auto step_start = std::chrono::steady_clock::now();
+    std::string winner;
+    if (room->rewind_from != 0) {
+        uint32_t from = room->rewind_from;
+        room->rewind_from = 0;
+        room->resync = true;
+        metrics.rewinds.add(1);
+        metrics.rewound_ticks.add(room->tick - from + 1);
+        winner = rewind_match(*room, from);
+    }
+    if (winner.empty()) {
+        winner = step_match(*room, room->tick + 1);
+    }
+    auto step_end = std::chrono::steady_clock::now();
+    metrics.tick_time.observe_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(step_end - step_start).count());
+    if (!winner.empty()) {
+        end_match(*room, winner);
+        return;
+    }
+
+    ++room->tick;
+    send_state_to_room(*room);
+    metrics.broadcast_latency.observe_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - room->next_tick).count());
+    if (room->recording && room->tick > rewind_ticks) {
+        record_ticks(*room, room->tick - rewind_ticks);
+    }
+    if (!room->bot_slots.empty()) {
+        plan_bots(room);
+    }
+
+    schedule_tick(s, room);
+}
+
+// Arm the room timer for the next tick. Deadlines advance by a fixed step so the
+// tick rate does not drift with the time spent simulating and broadcasting.
+void schedule_tick(server* s, room_ptr room) {
+    room->next_tick += std::chrono::milliseconds(tick_interval_ms);
+    room->tick_timer->expires_at(room->next_tick);
+    room->tick_timer->async_wait(room->room_strand.wrap(bind(&on_tick, s, room, room->tick_timer, ::_1)));
+}
+
+// Tell every player its slot and spectators the size of the match:
+// GAME_START <room_id> <slot, -1 for spectators> <players> <tick_ms>
+void announce_start(Room& room) {
+    std::string size = " " + std::to_string(room.players.size()) + " " + std::to_string(tick_interval_ms);
+    for (size_t slot = 0; slot < room.players.size(); ++slot) {
+        send_message_to_player(room.players[slot].con, "GAME_START " + room.id + " " + std::to_string(slot) + size);
+    }
+    if (!room.spectators.empty()) {
+        message_ptr start = prepare_message("GAME_START " + room.id + " -1" + size, websocketpp::frame::opcode::text);
+        for (const RoomPlayer& spectator : room.spectators) {
+            send_prepared(spectator.con, start);
+        }
+    }
+}
+
+void start_match(server* s, room_ptr room) {
+    reset_match(*room);
+    std::fill(std::begin(room->slot_ids), std::end(room->slot_ids), 0);
+    room->bot_slots.clear();
+    for (size_t slot = 0; slot < room->players.size(); ++slot) {
+        room->slot_ids[slot] = room->players[slot].id;
+        if (room->players[slot].bot) {
+            room->bot_slots.push_back(static_cast<int>(slot));
+        }
+    }
+    ++room->match_serial;
+    room->game_started = true;
+    room->tick = 0;
+    set_room_idle(*room, 0);
+    room->match_start_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    metrics.started_rooms.add(1);
+    lobby.publish(*room);
+
+    if (recorder.enabled()) {
+        tron_record::FileHeader header;
+        header.width = W;
+        header.height = H;
+        header.tick_ms = tick_interval_ms;
+        header.players = static_cast<int>(room->players.size());
+        header.room_id = room->id;
+        header.start_ms = room->match_start_ms;
+        room->recording = recorder.create(header);
+    }
+
+    room->tick_timer = std::make_shared<steady_timer>(s->get_io_service());
+    room->next_tick = std::chrono::steady_clock::now();
+    schedule_tick(s, room);
+}
+
+// A player dropping out of a running match is out of it, its trail stays. The match
+// ends if that leaves a single player. Lockstep clients learn it from the next STEP.
+void forfeit_match(Room& room, conn_id id) {
+    if (!room.game_started) {
+        return;
+    }
+    for (size_t slot = 0; slot < room.game.players.size(); ++slot) {
+        if (room.slot_ids[slot] == id) {
+            room.slot_ids[slot] = 0;
+            room.game.eliminate(static_cast<int>(slot));
+            room.forfeited |= 1u << slot;
+        }
+    }
+    if (room.game.over()) {
+        end_match(room, room.game.result());
+    }
+}
+
+// Forget the room a connection claimed, unless it has moved on to another one already
+void clear_client_room(conn_id id, room_key key) {
+    clients.modify(id, [&](Client& client) {
+        if (client.room == key) {
+            client.room = tron_registry::NO_ROOM;
+        }
+        return true;
+    });
+}
+
+// Resume tokens are 128 random bits in hex. The first 64 bits find the room, which
+// checks the whole token against the seat.
+uint64_t resume_token_key(const std::string& token) {
+    if (token.size() != 32 || token.find_first_not_of("0123456789abcdef") != std::string::npos) {
+        return 0;
+    }
+    return std::strtoull(token.substr(0, 16).c_str(), nullptr, 16);
+}
+
+// Give a seated player a new resume token, replacing its previous one. Runs on the room strand.
+void issue_resume_token(Room& room, RoomPlayer& player) {
+    thread_local std::mt19937_64 generator(std::random_device{}());
+    if (!player.token.empty()) {
+        resume_tokens.erase(resume_token_key(player.token));
+    }
+    char token[33];
+    do {
+        std::snprintf(token, sizeof(token), "%016llx%016llx",
+                      static_cast<unsigned long long>(generator()), static_cast<unsigned long long>(generator()));
+    } while (resume_token_key(token) == 0 || tron_registry::shard_of(resume_token_key(token), shard_count) != shard_index ||
+             !resume_tokens.insert(resume_token_key(token), room.key));
+    player.token = token;
+    send_message_to_player(player.con, "RESUME_TOKEN " + room.id + " " + player.token);
+}
+
+// Forget everything that keeps a seat reserved: the token and the grace timer
+void release_seat(RoomPlayer& player) {
+    if (!player.token.empty()) {
+        resume_tokens.erase(resume_token_key(player.token));
+        player.token.clear();
+    }
+    if (player.grace_timer) {
+        player.grace_timer->cancel();
+        player.grace_timer.reset();
+    }
+    if (player.away) {
+        player.away = false;
+        metrics.away_players.add(-1);
+    }
+}
 
-using websocketpp::lib::placeholders::_1;
-using websocketpp::lib::placeholders::_2;
-using websocketpp::lib::bind;
+// Remove the room from the registry and stop its timer, sending its spectators away. A
+// match still running, as when the last human leaves bots playing on, ends abandoned
+// first, so it is counted, recorded and stored like any other. Runs on the room strand.
+void close_room(Room& room) {
+    if (room.game_started) {
+        end_match(room, "Match abandoned");
+    }
+    room.closed = true;
+    if (room.tick_timer) {
+        room.tick_timer->cancel();
+        room.tick_timer.reset();
+    }
+    active_rooms.erase(room.key);
+    lobby.remove(room);
+    for (RoomPlayer& player : room.players) {
+        release_seat(player);
+    }
 
-// pull out the type of messages sent by our config
-typedef websocketpp::config::asio::message_type::ptr message_ptr;
-typedef websocketpp::connection_hdl connection_hdl;
+    if (!room.spectators.empty()) {
+        message_ptr closed = prepare_message("ROOM_CLOSED " + room.id, websocketpp::frame::opcode::text);
+        for (const RoomPlayer& spectator : room.spectators) {
+            clear_client_room(spectator.id, room.key);
+            send_prepared(spectator.con, closed);
+        }
+        metrics.spectators.add(-static_cast<int64_t>(room.spectators.size()));
+        room.spectators.clear();
+        room.spectator_slot.clear();
+    }
+}
 
-// Room structure
-struct Room {
-    std::string id;
-    std::string name;
-    std::vector<connection_hdl> players;
-    bool game_started = false;
-    connection_hdl creator_hdl;
-    int max_players = 2; // For Tron, typically 2 players
+// Drop a spectator in O(1) by moving the last one into its place. Returns false if the
+// connection is not spectating this room.
+bool remove_spectator(Room& room, conn_id id) {
+    auto it = room.spectator_slot.find(id);
+    if (it == room.spectator_slot.end()) {
+        return false;
+    }
+    size_t slot = it->second;
+    room.spectator_slot.erase(it);
+    if (slot != room.spectators.size() - 1) {
+        room.spectators[slot] = room.spectators.back();
+        room.spectator_slot[room.spectators[slot].id] = slot;
+    }
+    room.spectators.pop_back();
+    metrics.spectators.add(-1);
+    return true;
+}
 
-    Room() = default; // Adicionar construtor padrão
-    Room(std::string room_id, std::string room_name, connection_hdl creator)
-        : id(room_id), name(room_name), creator_hdl(creator) {
-        players.push_back(creator);
+// Take a player or spectator out of a room, closing it when no player is left. Runs on
+// the room strand.
+void leave_room(Room& room, conn_id id, bool disconnected) {
+    if (room.closed) {
+        return;
     }
-};
+    if (remove_spectator(room, id)) {
+        TRON_LOG(Debug, room.id, id, "Spectator left room");
+        return;
+    }
+    // Rooms hold a handful of players, so a scan over ids is constant time
+    auto player = std::find_if(room.players.begin(), room.players.end(), [&](const RoomPlayer& p) { return p.id == id; });
+    if (player == room.players.end()) {
+        return; // Seat handed to a resumed connection already
+    }
+    release_seat(*player);
+    room.players.erase(player);
+    forfeit_match(room, id);
 
-// Global maps for managing rooms and connections
-std::map<std::string, Room> active_rooms; // room_id -> Room object
-std::map<connection_hdl, std::string, std::owner_less<connection_hdl>> player_to_room_map; // player_hdl -> room_id
+    if (disconnected) {
+        TRON_LOG(Info, room.id, id, "Player disconnected and left room");
+    } else {
+        TRON_LOG(Info, room.id, id, "Player left room");
+    }
 
-// Function to generate a random room ID
-std::string generate_room_id() {
-    std::string chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-    std::string s = "";
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_int_distribution<> distribution(0, chars.size() - 1);
-    for (int i = 0; i < 6; ++i) {
-        s += chars[distribution(generator)];
+    // Bots do not keep a room open
+    auto human = std::find_if(room.players.begin(), room.players.end(), [](const RoomPlayer& p) { return !p.bot; });
+    if (human == room.players.end()) {
+        close_room(room);
+        TRON_LOG(Info, room.id, 0, "Room is empty and closed");
+    } else {
+        // If creator left, assign the first remaining player as new creator
+        if (room.creator == id) {
+            room.creator = human->id;
+            send_message_to_player(human->con, "YOU_ARE_CREATOR " + room.id);
+            TRON_LOG(Info, room.id, room.creator, "Creator of room changed");
+        }
+        send_room_update(room);
+        lobby.publish(room);
     }
-    return s;
 }
 
-// Function to send a message to a specific player
-void send_message_to_player(server* s, connection_hdl hdl, const std::string& msg) {
-    try {
-        s->send(hdl, msg, websocketpp::frame::opcode::text);
-    } catch (websocketpp::exception const & e) {
-        std::cerr << "Error sending message to player: " << e.what() << std::endl;
+// A seated player's connection dropped: keep the seat for resume_grace_s so that the
+// player can RESUME it from a new connection, and leave the room once that runs out.
+// The match goes on without it meanwhile. Runs on the room strand.
+void suspend_player(server* s, room_ptr room, conn_id id) {
+    if (room->closed) {
+        return;
+    }
+    auto player = std::find_if(room->players.begin(), room->players.end(), [&](const RoomPlayer& p) { return p.id == id; });
+    if (player == room->players.end() || player->token.empty() || resume_grace_s == 0) {
+        leave_room(*room, id, true);
+        return;
+    }
+    player->con.reset();
+    player->away = true;
+    metrics.away_players.add(1);
+    player->grace_timer = std::make_shared<steady_timer>(s->get_io_service(), std::chrono::seconds(resume_grace_s));
+    player->grace_timer->async_wait(room->room_strand.wrap([room, id](websocketpp::lib::asio::error_code const & ec) {
+        if (ec || room->closed) {
+            return;
+        }
+        auto seat = std::find_if(room->players.begin(), room->players.end(), [&](const RoomPlayer& p) { return p.id == id; });
+        if (seat != room->players.end() && seat->away) {
+            metrics.resume_expired.add();
+            leave_room(*room, id, true);
+        }
+    }));
+    TRON_LOG(Info, room->id, id, "Player disconnected, seat held for %d s", resume_grace_s);
+}
+
+// Hand the seat holding token to connection id and catch it up on the room:
+// RESUMED <room_id> <slot, -1 outside a match> <players> <tick_ms> <1 if a match is running>,
+// a fresh RESUME_TOKEN, then a keyframe of the match or the room update.
+// A seat still held by a live connection is taken over and that connection closed.
+// Runs on the room strand.
+void resume_player(Room& room, connection_ptr con, conn_id id, bool binary, const std::string& token) {
+    auto player = std::find_if(room.players.begin(), room.players.end(), [&](const RoomPlayer& p) { return !p.token.empty() && p.token == token; });
+    if (room.closed || player == room.players.end()) {
+        clear_client_room(id, room.key);
+        send_message_to_player(con, "ERROR Resume token expired.");
+        return;
+    }
+    conn_id previous = player->id;
+    if (player->away) {
+        player->away = false;
+        metrics.away_players.add(-1);
+    } else {
+        clear_client_room(previous, room.key);
+        if (player->con) {
+            websocketpp::lib::error_code ec;
+            player->con->close(websocketpp::close::status::policy_violation, "Session resumed elsewhere", ec);
+        }
+    }
+    if (player->grace_timer) {
+        player->grace_timer->cancel();
+        player->grace_timer.reset();
+    }
+    player->id = id;
+    player->con = con;
+    player->binary = binary;
+    player->behind = false; // Caught up by the snapshot below
+    if (room.creator == previous) {
+        room.creator = id;
+    }
+    int slot = -1;
+    if (room.game_started) {
+        for (size_t i = 0; i < room.game.players.size(); ++i) {
+            if (room.slot_ids[i] == previous) {
+                room.slot_ids[i] = id;
+                slot = static_cast<int>(i);
+            }
+        }
+    }
+
+    size_t players = room.game_started ? room.game.players.size() : room.players.size();
+    send_message_to_player(con, "RESUMED " + room.id + " " + std::to_string(slot) + " " + std::to_string(players) + " " +
+                           std::to_string(tick_interval_ms) + " " + (room.game_started ? "1" : "0"));
+    issue_resume_token(room, *player);
+    if (!room.game_started) {
+        send_room_update(room);
+    } else if (binary) {
+        send_prepared(con, prepare_message(encode_state_frame(room, true), websocketpp::frame::opcode::binary));
+    } else {
+        send_message_to_player(con, encode_text_keyframe(room));
+    }
+    metrics.resumes.add();
+    TRON_LOG(Info, room.id, id, "Player resumed seat of connection %llu", static_cast<unsigned long long>(previous));
+}
+
+// Look up the room named by a message, accepting lowercase ids
+bool find_room(const std::string& room_id, room_ptr& room) {
+    room_key key;
+    return tron_registry::pack_room_id(room_id, key) && active_rooms.find(key, room);
+}
+
+// Put a matched player back in the quick-match queue, keeping their place, when the
+// room made for them fell through
+void requeue_player(const QueuedPlayer& player, room_key key) {
+    bool requeued = clients.modify(player.id, [&](Client& c) {
+        if (c.room != key) {
+            return false;
+        }
+        c.room = tron_registry::NO_ROOM;
+        c.queued = true;
+        return true;
+    });
+    if (requeued) {
+        match_queue.push(player);
+    }
+}
+
+// Seat a matched pair and start their match. Runs on the room strand, so a player who
+// disconnected or was not claimed since the pairing is noticed here and the other one
+// goes back to the queue.
+void seat_quick_match(server* s, room_ptr room, std::vector<QueuedPlayer> matched) {
+    if (!room->closed) {
+        for (const QueuedPlayer& player : matched) {
+            Client client;
+            if (clients.find(player.id, client) && client.room == room->key) {
+                room->players.push_back(RoomPlayer(player.id, client.con, client.binary));
+            }
+        }
+    }
+    if (room->closed || room->players.size() < matched.size()) {
+        for (const QueuedPlayer& player : matched) {
+            requeue_player(player, room->key);
+        }
+        if (!room->closed) {
+            close_room(*room);
+        }
+        return;
+    }
+
+    room->creator = room->players[0].id;
+    for (size_t slot = 0; slot < room->players.size(); ++slot) {
+        send_message_to_player(room->players[slot].con, "MATCH_FOUND " + room->id + " " + std::to_string(slot));
+        issue_resume_token(*room, room->players[slot]);
+    }
+    announce_start(*room);
+    start_match(s, room);
+    metrics.quick_matches.add();
+    TRON_LOG(Info, room->id, room->creator, "Quick match started");
+}
+
+// Make a room for a matched pair and claim both players for it
+void create_quick_match(server* s, const std::vector<QueuedPlayer>& matched) {
+    room_ptr room = std::make_shared<Room>(s->get_io_service(), "Quick match");
+    room->quick_match = true;
+    do {
+        room->key = generate_room_key();
+        room->id = tron_registry::unpack_room_id(room->key);
+    } while (!active_rooms.insert(room->key, room));
+    track_idle(Reapable{0, room->key});
+
+    // A claim fails if the player cancelled or queued again meanwhile; seat_quick_match
+    // then sends the other one back to the queue
+    for (const QueuedPlayer& player : matched) {
+        clients.modify(player.id, [&](Client& c) {
+            if (!c.queued || c.match_ticket != player.ticket) {
+                return false;
+            }
+            c.queued = false;
+            c.room = room->key;
+            return true;
+        });
+    }
+    room->room_strand.post(bind(&seat_quick_match, s, room, matched));
+}
+
+// Players waiting for an opponent. Only run_matcher touches it, and that runs on the
+// lobby timer, never concurrently with itself.
+std::vector<QueuedPlayer> match_waiting;
+
+// Pair everyone waiting for a quick match in one pass. Requests are bucketed by RTT when
+// --match-rtt-ms is set; the pairs within a bucket go by arrival order.
+void run_matcher(server* s) {
+    match_queue.take(match_waiting);
+    auto now = std::chrono::steady_clock::now();
+
+    // Drop requests of players who left, cancelled or queued again, and bucket the rest.
+    // Players who waited too long for their own bucket go to bucket -1, which pairs with anyone.
+    size_t live = 0;
+    for (const QueuedPlayer& player : match_waiting) {
+        Client client;
+        if (!clients.find(player.id, client) || !client.queued || client.match_ticket != player.ticket) {
+            continue;
+        }
+        QueuedPlayer& kept = match_waiting[live++];
+        kept = player;
+        if (match_rtt_bucket_ms <= 0 || now - player.queued_at >= match_bucket_wait) {
+            kept.bucket = -1;
+        } else {
+            kept.bucket = client.rtt_ms < 0 ? INT_MAX : client.rtt_ms / match_rtt_bucket_ms;
+        }
+    }
+    match_waiting.resize(live);
+    std::stable_sort(match_waiting.begin(), match_waiting.end(),
+                     [](const QueuedPlayer& a, const QueuedPlayer& b) { return a.bucket < b.bucket; });
+
+    // Pair neighbours within each bucket; at most one player per bucket is left over
+    std::vector<QueuedPlayer> leftover;
+    size_t matches = 0;
+    for (size_t i = 0; i < match_waiting.size(); ) {
+        if (i + 1 < match_waiting.size() && match_waiting[i].bucket == match_waiting[i + 1].bucket) {
+            create_quick_match(s, {match_waiting[i], match_waiting[i + 1]});
+            ++matches;
+            i += 2;
+        } else {
+            leftover.push_back(match_waiting[i]);
+            ++i;
+        }
+    }
+
+    // A player who waited too long (sorted first) takes the oldest of the other leftovers
+    if (leftover.size() >= 2 && leftover[0].bucket == -1) {
+        auto oldest = std::min_element(leftover.begin() + 1, leftover.end(),
+            [](const QueuedPlayer& a, const QueuedPlayer& b) { return a.queued_at < b.queued_at; });
+        create_quick_match(s, {leftover[0], *oldest});
+        ++matches;
+        leftover.erase(oldest);
+        leftover.erase(leftover.begin());
+    }
+
+    match_waiting.swap(leftover);
+    metrics.match_queue.set(match_waiting.size());
+    if (matches > 0) {
+        TRON_LOG(Debug, "", 0, "Matcher paired %zu match(es), %zu player(s) still waiting", matches, match_waiting.size());
+    }
+}
+
+// Idle timeouts of every room and connection, on one timer wheel advanced by the lobby
+// tick in steps of reap_tick_ms. Activity never touches the wheel: it only moves the
+// object's idle deadline forward, and when the wheel entry comes due the reaper sees
+// the newer deadline and files the entry again for it. An entry thus fires about once
+// per timeout, whatever the traffic, and each firing is O(1).
+const int64_t reap_tick_ms = 100;
+const int64_t room_recheck_ms = 30000; // Running matches, and rooms already being closed
+tron_timer::TimerWheel<Reapable> reap_wheel;
+std::vector<Reapable> reap_incoming;
+
+uint64_t reap_tick(int64_t ms) {
+    return static_cast<uint64_t>((ms + reap_tick_ms - 1) / reap_tick_ms);
+}
+
+// Close a room that stayed idle past its deadline, sending its players away. Runs on the
+// room strand, where the deadline can be trusted.
+void reap_room(room_ptr room) {
+    if (room->closed || room->game_started || uptime_ms() < room->idle_deadline_ms.load(std::memory_order_relaxed)) {
+        return;
+    }
+    TRON_LOG(Info, room->id, 0, "Closing idle room");
+    message_ptr closed = prepare_message("ROOM_CLOSED " + room->id, websocketpp::frame::opcode::text);
+    for (const RoomPlayer& player : room->players) {
+        if (!player.bot) {
+            clear_client_room(player.id, room->key);
+            send_prepared(player.con, closed);
+        }
+    }
+    close_room(*room);
+    metrics.idle_rooms_closed.add();
+}
+
+// Tick to look at the room again, 0 once it is gone
+uint64_t check_room(room_key key, int64_t now) {
+    room_ptr room;
+    if (!active_rooms.find(key, room)) {
+        return 0;
+    }
+    int64_t deadline = room->idle_deadline_ms.load(std::memory_order_relaxed);
+    if (deadline == Room::NEVER) {
+        return reap_tick(now + room_recheck_ms);
     }
+    if (now < deadline) {
+        return reap_tick(deadline);
+    }
+    room->room_strand.post(bind(&reap_room, room));
+    return reap_tick(now + room_recheck_ms);
 }
 
-// Function to send a message to all players in a room
-void send_message_to_room(server* s, const std::string& room_id, const std::string& msg) {
-    if (active_rooms.count(room_id)) {
-        for (auto hdl : active_rooms.at(room_id).players) {
-            send_message_to_player(s, hdl, msg);
+// Ping a silent connection, close it if it stayed silent since. Tick to look at it again, 0 once it is gone.
+uint64_t check_connection(conn_id id, int64_t now) {
+    connection_ptr con;
+    int64_t next = 0;
+    bool ping = false;
+    bool found = clients.modify(id, [&](Client& c) {
+        con = c.con;
+        int64_t idle_until = c.last_activity + connection_idle_s * 1000LL;
+        if (now < idle_until) {
+            c.idle_ping = false;
+            next = idle_until;
+        } else if (!c.idle_ping) {
+            c.idle_ping = ping = true;
+            next = now + idle_ping_wait_ms;
         }
+        return true;
+    });
+    if (!found) {
+        return 0;
+    }
+    websocketpp::lib::error_code ec;
+    if (ping) {
+        con->ping("idle", ec);
+    } else if (next == 0) {
+        TRON_LOG(Info, "", id, "Closing idle connection");
+        con->close(websocketpp::close::status::going_away, "Idle", ec);
+        metrics.idle_connections_closed.add();
+        return 0; // on_close removes it
+    }
+    return reap_tick(next);
+}
+
+// First look at a new room: its idle deadline, or the lobby timeout when the room strand
+// has not set one yet, unless the recheck comes sooner
+int64_t first_room_check(room_key key, int64_t now) {
+    int64_t at = now + room_recheck_ms;
+    if (lobby_idle_s > 0) {
+        at = std::min<int64_t>(at, now + lobby_idle_s * 1000LL);
+    }
+    room_ptr room;
+    if (active_rooms.find(key, room)) {
+        at = std::min(at, room->idle_deadline_ms.load(std::memory_order_relaxed));
     }
+    return at;
 }
 
-void on_message(server* s, connection_hdl hdl, message_ptr msg) {
-    std::cout << "on_message from " << hdl.lock().get() << ": " << msg->get_payload() << std::endl;
+void run_reaper() {
+    int64_t now = uptime_ms();
+    reap_queue.take(reap_incoming);
+    for (const Reapable& item : reap_incoming) {
+        reap_wheel.schedule(reap_tick(item.id != 0 ? now + connection_idle_s * 1000LL : first_room_check(item.room, now)), item);
+    }
+    reap_incoming.clear();
+    reap_wheel.advance(now / reap_tick_ms, [now](const Reapable& item) {
+        return item.id != 0 ? check_connection(item.id, now) : check_room(item.room, now);
+    });
+    metrics.idle_tracked.set(reap_wheel.size());
+}
+
+// Lobby housekeeping on a fixed period: pair the quick-match queue in one batch, send
+// the lobby diffs that piled up since the last tick and close what went idle
+void on_lobby_tick(server* s, std::shared_ptr<steady_timer> timer, websocketpp::lib::asio::error_code const & ec) {
+    if (ec) {
+        return;
+    }
+    run_matcher(s);
+    lobby.flush();
+    run_reaper();
+
+    timer->expires_at(timer->expiry() + std::chrono::milliseconds(lobby_interval_ms));
+    timer->async_wait(bind(&on_lobby_tick, s, timer, ::_1));
+}
+
+// Messages of one connection are delivered in order, but may run on any thread of the
+// pool. Anything touching a room is posted to that room's strand.
+void on_message(server* s, conn_id id, connection_hdl, message_ptr msg) {
+    metrics.messages_in.add();
+    metrics.bytes_in.add(msg->get_payload().size());
+    TRON_LOG_SAMPLED(Debug, "", id, "on_message: %s", msg->get_payload().c_str());
 
     std::stringstream ss(msg->get_payload());
     std::string command;
     ss >> command;
 
+    Client client;
+    int64_t now_ms = uptime_ms();
+    if (!clients.modify(id, [&](Client& c) { c.last_activity = now_ms; client = c; return true; })) {
+        return;
+    }
+    connection_ptr con = client.con;
+
     if (command == "CREATE_ROOM") {
         std::string room_name;
         std::getline(ss, room_name); // Read the rest of the line as room name
         if (room_name.empty()) {
-            send_message_to_player(s, hdl, "ERROR Room name cannot be empty.");
+            send_message_to_player(con, "ERROR Room name cannot be empty.");
             return;
         }
-        
+
         // Check if player is already in a room
-        if (player_to_room_map.count(hdl)) {
-            send_message_to_player(s, hdl, "ERROR Already in a room. Leave current room first.");
+        if (client.room != tron_registry::NO_ROOM) {
+            send_message_to_player(con, "ERROR Already in a room. Leave current room first.");
+            return;
+        }
+        if (client.queued) {
+            send_message_to_player(con, "ERROR Waiting for a quick match. Cancel it first.");
             return;
         }
 
-        std::string new_room_id;
+        room_ptr room = std::make_shared<Room>(s->get_io_service(), room_name, RoomPlayer(id, con, client.binary));
         do {
-            new_room_id = generate_room_id();
-        } while (active_rooms.count(new_room_id)); // Ensure unique ID
+            room->key = generate_room_key();
+            room->id = tron_registry::unpack_room_id(room->key); // Before the room can be found
+        } while (!active_rooms.insert(room->key, room)); // Ensure unique ID
+        track_idle(Reapable{0, room->key});
+        clients.modify(id, [&](Client& c) { c.room = room->key; return true; });
 
-        active_rooms.emplace(new_room_id, Room(new_room_id, room_name, hdl));
-        player_to_room_map[hdl] = new_room_id;
-
-        send_message_to_player(s, hdl, "ROOM_CREATED " + new_room_id);
-        send_message_to_room(s, new_room_id, "ROOM_UPDATE " + new_room_id + " " + std::to_string(active_rooms.at(new_room_id).players.size()) + " " + std::to_string(active_rooms.at(new_room_id).max_players));
-        std::cout << "Room created: " << new_room_id << " by " << hdl.lock().get() << std::endl;
+        room->room_strand.dispatch([room, con, id]() {
+            send_message_to_player(con, "ROOM_CREATED " + room->id);
+            issue_resume_token(*room, room->players.front());
+            send_room_update(*room);
+            lobby.publish(*room);
+            TRON_LOG(Info, room->id, id, "Room created");
+        });
 
     } else if (command == "JOIN_ROOM") {
         std::string room_id;
         ss >> room_id;
 
         // Check if player is already in a room
-        if (player_to_room_map.count(hdl)) {
-            send_message_to_player(s, hdl, "ERROR Already in a room. Leave current room first.");
+        if (client.room != tron_registry::NO_ROOM) {
+            send_message_to_player(con, "ERROR Already in a room. Leave current room first.");
+            return;
+        }
+        if (client.queued) {
+            send_message_to_player(con, "ERROR Waiting for a quick match. Cancel it first.");
+            return;
+        }
+
+        room_ptr room;
+        if (!find_room(room_id, room)) {
+            send_message_to_player(con, "ERROR Room not found.");
             return;
         }
 
-        if (active_rooms.count(room_id)) {
-            Room& room = active_rooms.at(room_id);
-            if (room.players.size() < room.max_players) {
-                room.players.push_back(hdl);
-                player_to_room_map[hdl] = room_id;
-                send_message_to_player(s, hdl, "ROOM_JOINED " + room_id);
-                send_message_to_room(s, room_id, "ROOM_UPDATE " + room_id + " " + std::to_string(room.players.size()) + " " + std::to_string(room.max_players));
-                std::cout << "Player " << hdl.lock().get() << " joined room: " << room_id << std::endl;
+        // Claim the room now so that a second JOIN/CREATE is refused while this one is pending
+        clients.modify(id, [&](Client& c) { c.room = room->key; return true; });
+        bool binary = client.binary;
+
+        room->room_strand.post([room, con, id, binary]() {
+            if (room->closed) {
+                clear_client_room(id, room->key);
+                send_message_to_player(con, "ERROR Room not found.");
+            } else if (room->quick_match) {
+                clear_client_room(id, room->key);
+                send_message_to_player(con, "ERROR Quick match rooms cannot be joined.");
+            } else if (room->players.size() < static_cast<size_t>(room->max_players)) {
+                room->players.push_back(RoomPlayer(id, con, binary));
+                send_message_to_player(con, "ROOM_JOINED " + room->id);
+                issue_resume_token(*room, room->players.back());
+                send_room_update(*room);
+                lobby.publish(*room);
+                TRON_LOG(Info, room->id, id, "Player joined room");
             } else {
-                send_message_to_player(s, hdl, "ERROR Room is full.");
+                clear_client_room(id, room->key);
+                send_message_to_player(con, "ERROR Room is full.");
             }
+        });
+
+    } else if (command == "LEAVE_ROOM") {
+        std::string room_id;
+        ss >> room_id;
+
+        room_ptr room;
+        if (find_room(room_id, room) && client.room == room->key) {
+            clear_client_room(id, room->key);
+            room->room_strand.post([room, con, id]() {
+                send_message_to_player(con, "ROOM_LEFT " + room->id);
+                leave_room(*room, id, false);
+            });
         } else {
-            send_message_to_player(s, hdl, "ERROR Room not found.");
+            send_message_to_player(con, "ERROR Not in specified room or room not found.");
         }
 
-    } else if (command == "LEAVE_ROOM") {
+    } else if (command == "START_GAME") {
         std::string room_id;
         ss >> room_id;
 
-        if (player_to_room_map.count(hdl) && player_to_room_map.at(hdl) == room_id) {
-            Room& room = active_rooms.at(room_id);
-            
-            // Remove player from room
-            room.players.erase(std::remove_if(room.players.begin(), room.players.end(),
-                                              [&](connection_hdl p_hdl){ return p_hdl.lock().get() == hdl.lock().get(); }),
-                               room.players.end());
-            player_to_room_map.erase(hdl);
-
-            send_message_to_player(s, hdl, "ROOM_LEFT " + room_id);
-            std::cout << "Player " << hdl.lock().get() << " left room: " << room_id << std::endl;
-
-            if (room.players.empty()) {
-                active_rooms.erase(room_id);
-                std::cout << "Room " << room_id << " is empty and closed." << std::endl;
+        room_ptr room;
+        if (!find_room(room_id, room)) {
+            send_message_to_player(con, "ERROR Room not found.");
+            return;
+        }
+
+        room->room_strand.post([s, room, con, id]() {
+            if (room->closed) {
+                send_message_to_player(con, "ERROR Room not found.");
+            } else if (room->creator == id) { // Only creator can start
+                if (room->game_started) {
+                    send_message_to_player(con, "ERROR Game already started.");
+                } else if (room->players.size() >= 2) {
+                    announce_start(*room);
+                    start_match(s, room);
+                    TRON_LOG(Info, room->id, id, "Game started");
+                } else {
+                    send_message_to_player(con, "ERROR Not enough players to start game.");
+                }
+            } else {
+                send_message_to_player(con, "ERROR Only the room creator can start the game.");
+            }
+        });
+
+    } else if (command == "SET_ROOM") {
+        // SET_ROOM players <2..16> | mode <state|lockstep>, by the creator before the match starts
+        std::string setting, argument;
+        ss >> setting >> argument;
+        int value = std::atoi(argument.c_str());
+        if (setting == "players") {
+            if (value < 2 || value > tron_game::MAX_PLAYERS) {
+                send_message_to_player(con, "ERROR Rooms hold 2 to " + std::to_string(tron_game::MAX_PLAYERS) + " players.");
+                return;
+            }
+        } else if (setting == "mode") {
+            if (argument != "state" && argument != "lockstep") {
+                send_message_to_player(con, "ERROR Room mode is state or lockstep.");
+                return;
+            }
+        } else {
+            send_message_to_player(con, "ERROR Unknown room setting.");
+            return;
+        }
+        room_ptr room;
+        if (client.room == tron_registry::NO_ROOM || !active_rooms.find(client.room, room)) {
+            send_message_to_player(con, "ERROR Not in a room.");
+            return;
+        }
+
+        room->room_strand.post([room, con, id, setting, argument, value]() {
+            if (room->closed || room->creator != id || room->quick_match) {
+                send_message_to_player(con, "ERROR Only the room creator can change the room.");
+            } else if (room->game_started) {
+                send_message_to_player(con, "ERROR Game already started.");
+            } else if (setting == "players" && static_cast<size_t>(value) < room->players.size()) {
+                send_message_to_player(con, "ERROR More players than that are in the room.");
+            } else {
+                if (setting == "players") {
+                    room->max_players = value;
+                } else {
+                    room->lockstep = argument == "lockstep";
+                }
+                send_room_update(*room);
+                lobby.publish(*room);
+            }
+        });
+
+    } else if (command == "ADD_BOT" || command == "REMOVE_BOT") {
+        // ADD_BOT [count] seats server bots in free seats, REMOVE_BOT takes the last one out.
+        // Creator only, before the match starts.
+        int count = 1;
+        ss >> count;
+        count = std::min(std::max(count, 1), tron_game::MAX_PLAYERS);
+        room_ptr room;
+        if (client.room == tron_registry::NO_ROOM || !active_rooms.find(client.room, room)) {
+            send_message_to_player(con, "ERROR Not in a room.");
+            return;
+        }
+        if (!bot_pool.enabled()) {
+            send_message_to_player(con, "ERROR Bots are disabled on this server.");
+            return;
+        }
+        bool add = command == "ADD_BOT";
+
+        room->room_strand.post([room, con, id, count, add]() {
+            if (room->closed || room->creator != id || room->quick_match) {
+                send_message_to_player(con, "ERROR Only the room creator can change the room.");
+                return;
+            }
+            if (room->game_started) {
+                send_message_to_player(con, "ERROR Game already started.");
+                return;
+            }
+            int changed = 0;
+            if (add) {
+                for (; changed < count && room->players.size() < static_cast<size_t>(room->max_players); ++changed) {
+                    room->players.push_back(RoomPlayer(connection_ids.next(), nullptr, false, true));
+                }
             } else {
-                // If creator left, assign new creator or close room
-                if (room.creator_hdl.lock().get() == hdl.lock().get()) {
-                    room.creator_hdl = room.players[0]; // Assign first player as new creator
-                    send_message_to_player(s, room.creator_hdl, "YOU_ARE_CREATOR " + room_id);
-                    std::cout << "Creator of room " << room_id << " changed to " << room.creator_hdl.lock().get() << std::endl;
+                for (auto it = room->players.end(); changed < count && it != room->players.begin();) {
+                    if ((--it)->bot) {
+                        it = room->players.erase(it);
+                        ++changed;
+                    }
                 }
-                send_message_to_room(s, room_id, "ROOM_UPDATE " + room_id + " " + std::to_string(room.players.size()) + " " + std::to_string(room.max_players));
             }
+            if (changed == 0) {
+                send_message_to_player(con, add ? "ERROR Room is full." : "ERROR No bots in the room.");
+                return;
+            }
+            send_room_update(*room);
+            lobby.publish(*room);
+            TRON_LOG(Info, room->id, id, "%s %d bot(s)", add ? "Added" : "Removed", changed);
+        });
+
+    } else if (command == "LIST_ROOMS") {
+        // LIST_ROOMS [all|open|started] [cursor from the previous page, or -] [limit]
+        std::string filter_name = "all", cursor = "-";
+        size_t limit = 20;
+        ss >> filter_name >> cursor >> limit;
+        Lobby::Filter filter;
+        if (filter_name == "all") {
+            filter = Lobby::All;
+        } else if (filter_name == "open") {
+            filter = Lobby::Open;
+        } else if (filter_name == "started") {
+            filter = Lobby::Started;
         } else {
-            send_message_to_player(s, hdl, "ERROR Not in specified room or room not found.");
+            send_message_to_player(con, "ERROR Unknown room filter.");
+            return;
+        }
+        room_key after = tron_registry::NO_ROOM;
+        if (cursor != "-" && !tron_registry::pack_room_id(cursor, after)) {
+            send_message_to_player(con, "ERROR Invalid cursor.");
+            return;
         }
+        send_message_to_player(con, lobby.list(filter, after, std::min<size_t>(std::max<size_t>(limit, 1), 100)));
 
-    } else if (command == "START_GAME") {
+    } else if (command == "SUBSCRIBE_LOBBY") {
+        lobby.subscribe(id, con);
+        send_message_to_player(con, "LOBBY_SUBSCRIBED");
+
+    } else if (command == "UNSUBSCRIBE_LOBBY") {
+        lobby.unsubscribe(id);
+        send_message_to_player(con, "LOBBY_UNSUBSCRIBED");
+
+    } else if (command == "SPECTATE") {
         std::string room_id;
         ss >> room_id;
 
-        if (active_rooms.count(room_id)) {
-            Room& room = active_rooms.at(room_id);
-            if (room.creator_hdl.lock().get() == hdl.lock().get()) { // Only creator can start
-                if (room.players.size() == room.max_players) { // Only start if room is full
-                    room.game_started = true;
-                    send_message_to_room(s, room_id, "GAME_START " + room_id);
-                    std::cout << "Game started in room: " << room_id << std::endl;
-                } else {
-                    send_message_to_player(s, hdl, "ERROR Not enough players to start game.");
+        if (client.room != tron_registry::NO_ROOM || client.queued) {
+            send_message_to_player(con, "ERROR Already in a room. Leave current room first.");
+            return;
+        }
+        room_ptr room;
+        if (!find_room(room_id, room)) {
+            send_message_to_player(con, "ERROR Room not found.");
+            return;
+        }
+
+        clients.modify(id, [&](Client& c) { c.room = room->key; return true; });
+        bool binary = client.binary;
+
+        room->room_strand.post([room, con, id, binary]() {
+            if (room->closed) {
+                clear_client_room(id, room->key);
+                send_message_to_player(con, "ERROR Room not found.");
+                return;
+            }
+            room->spectator_slot[id] = room->spectators.size();
+            room->spectators.push_back(RoomPlayer(id, con, binary));
+            metrics.spectators.add(1);
+            // SPECTATING <room_id> <1 if a match is running> <players> <tick_ms>
+            size_t players = room->game_started ? room->game.players.size() : room->players.size();
+            send_message_to_player(con, "SPECTATING " + room->id + " " + (room->game_started ? "1" : "0") + " " +
+                                   std::to_string(players) + " " + std::to_string(tick_interval_ms));
+            // A keyframe lets the spectator draw the trails of the match it walked into
+            if (room->game_started) {
+                send_prepared(con, binary ? prepare_message(encode_state_frame(*room, true), websocketpp::frame::opcode::binary)
+                                          : prepare_message(encode_text_keyframe(*room), websocketpp::frame::opcode::text));
+            }
+            TRON_LOG(Debug, room->id, id, "Spectator joined room");
+        });
+
+    } else if (command == "QUICK_MATCH") {
+        if (client.room != tron_registry::NO_ROOM) {
+            send_message_to_player(con, "ERROR Already in a room. Leave current room first.");
+            return;
+        }
+        uint32_t ticket = 0;
+        bool queued = clients.modify(id, [&](Client& c) {
+            if (c.queued || c.room != tron_registry::NO_ROOM) {
+                return false;
+            }
+            c.queued = true;
+            ticket = ++c.match_ticket;
+            return true;
+        });
+        if (!queued) {
+            send_message_to_player(con, "ERROR Already waiting for a quick match.");
+            return;
+        }
+
+        // Time the round trip with a websocket ping for RTT bucketing, on_pong records it.
+        // Behind a router the round trip is the router's to measure, it sent RTT before.
+        auto now = std::chrono::steady_clock::now();
+        if (match_rtt_bucket_ms > 0 && worker_port == 0) {
+            websocketpp::lib::error_code ec;
+            con->ping(std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count()), ec);
+        }
+        match_queue.push(QueuedPlayer{id, ticket, now, 0});
+        send_message_to_player(con, "MATCH_QUEUED");
+
+    } else if (command == "CANCEL_MATCH") {
+        bool cancelled = clients.modify(id, [](Client& c) {
+            if (!c.queued) {
+                return false;
+            }
+            c.queued = false; // The matcher drops the request on its next tick
+            return true;
+        });
+        send_message_to_player(con, cancelled ? "MATCH_CANCELLED" : "ERROR Not waiting for a quick match.");
+
+    } else if (command == "RTT" && worker_port != 0) {
+        // RTT <ms>, the router's measurement of the player's round trip
+        int rtt = -1;
+        ss >> rtt;
+        if (rtt >= 0) {
+            clients.modify(id, [rtt](Client& c) {
+                c.rtt_ms = rtt;
+                return true;
+            });
+        }
+
+    } else if (command == "PING") {
+        // Echo the token back so clients and tron_loadgen can measure round-trip time
+        std::string token;
+        ss >> token;
+        send_message_to_player(con, "PONG " + token);
+
+    } else if (command == "INPUT") {
+        // INPUT <dir> [tick], tick being the one the client meant the turn for
+        int dir = -1;
+        uint32_t tick = 0;
+        ss >> dir >> tick;
+        room_ptr room;
+        if (dir < 0 || dir > 3 || client.room == tron_registry::NO_ROOM || !active_rooms.find(client.room, room)) {
+            return;
+        }
+
+        room->room_strand.post([room, id, dir, tick]() {
+            if (!room->game_started) {
+                return;
+            }
+            for (size_t slot = 0; slot < room->game.players.size(); ++slot) {
+                if (room->slot_ids[slot] == id) {
+                    queue_input(*room, static_cast<int>(slot), dir, tick);
+                }
+            }
+        });
+
+    } else if (command == "RESULTS") {
+        // RESULTS [count]: the most recent finished matches, read on the results writer thread
+        int limit = 10;
+        ss >> limit;
+        if (!results.enabled()) {
+            send_message_to_player(con, "ERROR Match results are not kept on this server.");
+        } else if (!results.query_recent(std::min(std::max(limit, 1), 50),
+                                         [con](const std::string& reply) { send_message_to_player(con, reply); })) {
+            send_message_to_player(con, "ERROR Server busy, try again.");
+        }
+
+    } else if (command == "RESYNC") {
+        // A lockstep client whose checksum disagreed, it gets a keyframe with the next tick
+        room_ptr room;
+        if (client.room == tron_registry::NO_ROOM || !active_rooms.find(client.room, room)) {
+            return;
+        }
+        room->room_strand.post([room, id]() {
+            for (RoomPlayer& player : room->players) {
+                if (player.id == id) {
+                    player.behind = true;
                 }
-            } else {
-                send_message_to_player(s, hdl, "ERROR Only the room creator can start the game.");
             }
+            auto spectator = room->spectator_slot.find(id);
+            if (spectator != room->spectator_slot.end()) {
+                room->spectators[spectator->second].behind = true;
+            }
+        });
+
+    } else if (command == "RESUME") {
+        std::string token;
+        ss >> token;
+
+        if (client.room != tron_registry::NO_ROOM || client.queued) {
+            send_message_to_player(con, "ERROR Already in a room. Leave current room first.");
+            return;
+        }
+        room_key key;
+        room_ptr room;
+        uint64_t token_key = resume_token_key(token);
+        if (token_key == 0 || !resume_tokens.find(token_key, key) || !active_rooms.find(key, room)) {
+            send_message_to_player(con, "ERROR Resume token expired.");
+            return;
+        }
+
+        clients.modify(id, [&](Client& c) { c.room = room->key; return true; });
+        bool binary = client.binary;
+
+        room->room_strand.post([room, con, id, binary, token]() {
+            resume_player(*room, con, id, binary, token);
+        });
+    }
+    // Add more game-specific message handling here
+}
+
+// True for a connection from this host. The game port is public, so anything that
+// changes the server is only served to local clients.
+bool from_loopback(const connection_ptr& con) {
+    websocketpp::lib::asio::error_code ec;
+    websocketpp::lib::asio::ip::tcp::endpoint peer = con->get_raw_socket().remote_endpoint(ec);
+    return !ec && peer.address().is_loopback();
+}
+
+// Plain HTTP requests on the websocket port: Prometheus scrapes /metrics
+void on_http(server* s, connection_hdl hdl) {
+    connection_ptr con = s->get_con_from_hdl(hdl);
+
+    // Change the log level at runtime: /log-level?debug, from this host only
+    const std::string level_prefix = "/log-level?";
+    if (con->get_resource().compare(0, level_prefix.size(), level_prefix) == 0) {
+        if (!from_loopback(con)) {
+            con->set_status(websocketpp::http::status_code::forbidden);
+            con->set_body("Forbidden\n");
+            return;
+        }
+        tron_log::Level level;
+        if (tron_log::parse_level(con->get_resource().substr(level_prefix.size()), level)) {
+            tron_log::logger().set_level(level);
+            con->set_status(websocketpp::http::status_code::ok);
+            con->set_body(std::string("log level ") + tron_log::level_name(level) + "\n");
         } else {
-            send_message_to_player(s, hdl, "ERROR Room not found.");
+            con->set_status(websocketpp::http::status_code::bad_request);
+            con->set_body("Unknown log level\n");
+        }
+        return;
+    }
+
+    if (con->get_resource() != "/metrics") {
+        con->set_status(websocketpp::http::status_code::not_found);
+        con->set_body("Not found\n");
+        return;
+    }
+
+    // Bytes waiting in the websocket send buffers, summed and worst connection
+    uint64_t queued_bytes = 0, max_queued_bytes = 0;
+    clients.for_each([&](conn_id, Client& client) {
+        uint64_t amount = client.con->get_buffered_amount();
+        queued_bytes += amount;
+        max_queued_bytes = std::max(max_queued_bytes, amount);
+    });
+
+    std::ostringstream out;
+    tron_metrics::render_gauge(out, "tron_connected_clients", "Open websocket connections.", clients.size());
+    tron_metrics::render_gauge(out, "tron_active_rooms", "Rooms that exist.", active_rooms.size());
+    tron_metrics::render_gauge(out, "tron_started_rooms", "Rooms running a match.", metrics.started_rooms.get());
+    tron_metrics::render_gauge(out, "tron_spectators", "Connections spectating a room.", metrics.spectators.get());
+    tron_metrics::render_gauge(out, "tron_match_queue_players", "Players waiting for a quick match.", metrics.match_queue.get());
+    tron_metrics::render_counter(out, "tron_state_ticks_dropped_total", "State ticks not sent to connections over their send budget.", metrics.ticks_dropped.get());
+    tron_metrics::render_counter(out, "tron_catchup_keyframes_total", "Keyframes sent to connections back under their send budget.", metrics.catchup_keyframes.get());
+    tron_metrics::render_counter(out, "tron_slow_closes_total", "Connections closed for exceeding the send limit.", metrics.slow_closes.get());
+    tron_metrics::render_gauge(out, "tron_idle_tracked", "Rooms and connections watched for idle timeouts.", metrics.idle_tracked.get());
+    tron_metrics::render_counter(out, "tron_idle_rooms_closed_total", "Rooms closed for being idle.", metrics.idle_rooms_closed.get());
+    tron_metrics::render_counter(out, "tron_idle_connections_closed_total", "Connections closed for not answering an idle ping.", metrics.idle_connections_closed.get());
+    tron_metrics::render_gauge(out, "tron_away_players", "Seats held for a disconnected player to resume.", metrics.away_players.get());
+    tron_metrics::render_counter(out, "tron_resumes_total", "Players that resumed their seat on a new connection.", metrics.resumes.get());
+    tron_metrics::render_counter(out, "tron_resume_expired_total", "Held seats given up after the grace period.", metrics.resume_expired.get());
+    tron_metrics::render_counter(out, "tron_quick_matches_total", "Matches started from the quick-match queue.", metrics.quick_matches.get());
+    tron_metrics::render_counter(out, "tron_rewinds_total", "Rewinds that re-simulated a match to apply late inputs.", metrics.rewinds.get());
+    tron_metrics::render_counter(out, "tron_rewound_ticks_total", "Ticks simulated again by rewinds.", metrics.rewound_ticks.get());
+    tron_metrics::render_counter(out, "tron_bot_decisions_total", "Moves chosen by server bots.", metrics.bot_decisions.get());
+    tron_metrics::render_counter(out, "tron_bot_skipped_total", "Bot moves not computed before their tick.", metrics.bot_skipped.get());
+    metrics.bot_decision_time.render(out, "tron_bot_decision_seconds", "Search time of one bot move.");
+    tron_metrics::render_gauge(out, "tron_lobby_subscribers", "Connections subscribed to lobby updates.", lobby.subscriber_count());
+    tron_metrics::render_counter(out, "tron_messages_in_total", "Websocket messages received.", metrics.messages_in.get());
+    tron_metrics::render_counter(out, "tron_bytes_in_total", "Payload bytes received.", metrics.bytes_in.get());
+    tron_metrics::render_counter(out, "tron_messages_out_total", "Websocket messages sent.", metrics.messages_out.get());
+    tron_metrics::render_counter(out, "tron_bytes_out_total", "Payload bytes sent.", metrics.bytes_out.get());
+    metrics.tick_time.render(out, "tron_tick_duration_seconds", "Time to simulate one room tick.");
+    metrics.broadcast_latency.render(out, "tron_broadcast_latency_seconds", "Tick deadline until the state is queued to every player.");
+    tron_metrics::render_gauge(out, "tron_send_queue_bytes", "Bytes buffered for sending over all connections.", queued_bytes);
+    tron_metrics::render_gauge(out, "tron_send_queue_max_bytes", "Bytes buffered for sending on the most backed up connection.", max_queued_bytes);
+    tron_metrics::render_counter(out, "tron_recorded_bytes_total", "Bytes written to match recordings.", recorder.bytes_written());
+    tron_metrics::render_counter(out, "tron_recording_errors_total", "Match recordings that failed to write.", recorder.errors());
+    tron_metrics::render_counter(out, "tron_results_written_total", "Match results committed to the results database.", results.written());
+    tron_metrics::render_counter(out, "tron_results_dropped_total", "Match results dropped because the results queue was full or the database stayed busy.", results.dropped());
+    tron_metrics::render_counter(out, "tron_results_errors_total", "Failed results database writes.", results.errors());
+    tron_metrics::render_counter(out, "tron_log_dropped_total", "Log entries dropped because the log ring was full.", tron_log::logger().dropped());
+
+    con->set_status(websocketpp::http::status_code::ok);
+    con->append_header("Content-Type", "text/plain; version=0.0.4");
+    con->set_body(out.str());
+}
+
+// Accept the binary state protocol when the client offers it in the handshake
+bool on_validate(server* s, connection_hdl hdl) {
+    connection_ptr con = s->get_con_from_hdl(hdl);
+    for (const std::string& protocol : con->get_requested_subprotocols()) {
+        if (protocol == tron_protocol::SUBPROTOCOL) {
+            con->select_subprotocol(protocol);
+            break;
         }
     }
-    // Add more game-specific message handling here (e.g., player movement)
+    return true;
 }
 
-void on_close(server* s, connection_hdl hdl) {
-    std::cout << "on_close for " << hdl.lock().get() << std::endl;
+// Answer to the reaper's ping, or to the one sent on QUICK_MATCH carrying its send time in microseconds
+void on_pong(conn_id id, connection_hdl, std::string payload) {
+    int64_t sent_us = std::strtoll(payload.c_str(), nullptr, 10);
+    int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t now_ms = uptime_ms();
+    clients.modify(id, [&](Client& c) {
+        c.last_activity = now_ms;
+        if (sent_us > 0 && now_us >= sent_us) {
+            c.rtt_ms = static_cast<int>((now_us - sent_us) / 1000);
+        }
+        return true;
+    });
+}
+
+void on_close(server* s, conn_id id, connection_hdl) {
+    TRON_LOG(Debug, "", id, "on_close");
+    lobby.unsubscribe(id);
 
     // Check if the disconnected player was in a room
-    if (player_to_room_map.count(hdl)) {
-        std::string room_id = player_to_room_map.at(hdl);
-        Room& room = active_rooms.at(room_id);
+    Client client;
+    room_ptr room;
+    if (clients.erase(id, &client) && client.room != tron_registry::NO_ROOM && active_rooms.find(client.room, room)) {
+        room->room_strand.post([s, room, id]() {
+            suspend_player(s, room, id);
+        });
+    }
+}
 
-        // Remove player from room
-        room.players.erase(std::remove_if(room.players.begin(), room.players.end(),
-                                          [&](connection_hdl p_hdl){ return p_hdl.lock().get() == hdl.lock().get(); }),
-                           room.players.end());
-        player_to_room_map.erase(hdl);
+// Give the connection its id and bind it into the connection's own handlers, so that
+// later messages and the close never have to map the handle back to an id
+void on_open(server* s, connection_hdl hdl) {
+    connection_ptr con = s->get_con_from_hdl(hdl);
+    conn_id id = connection_ids.next();
 
-        std::cout << "Player " << hdl.lock().get() << " disconnected and left room: " << room_id << std::endl;
+    Client client;
+    client.con = con;
+    client.binary = con->get_subprotocol() == tron_protocol::SUBPROTOCOL;
+    client.last_activity = uptime_ms();
+    clients.insert(id, client);
+    track_idle(Reapable{id, tron_registry::NO_ROOM});
 
-        if (room.players.empty()) {
-            active_rooms.erase(room_id);
-            std::cout << "Room " << room_id << " is empty and closed due to disconnect." << std::endl;
-        } else {
-            // If creator disconnected, assign new creator or close room
-            if (room.creator_hdl.lock().get() == hdl.lock().get()) {
-                if (!room.players.empty()) { // Ensure there's a player to assign as new creator
-                    room.creator_hdl = room.players[0]; // Assign first player as new creator
-                    send_message_to_player(s, room.creator_hdl, "YOU_ARE_CREATOR " + room_id);
-                    std::cout << "Creator of room " << room_id << " changed to " << room.creator_hdl.lock().get() << std::endl;
-                } else {
-                    // If no players left, room will be closed anyway
-                }
+    con->set_message_handler(bind(&on_message, s, id, ::_1, ::_2));
+    con->set_close_handler(bind(&on_close, s, id, ::_1));
+    con->set_pong_handler(bind(&on_pong, id, ::_1, ::_2));
+}
+
+int main(int argc, char* argv[]) {
+    int thread_count = 1;
+    bool access_log = false;
+    std::string record_dir; // Match recordings are off unless a directory is given
+    std::string results_db; // Likewise match results, unless a database file is given
+    tron_log::Logger& log = tron_log::logger();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--tick-ms" && i + 1 < argc) {
+            tick_interval_ms = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--lobby-ms" && i + 1 < argc) {
+            lobby_interval_ms = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--match-rtt-ms" && i + 1 < argc) {
+            match_rtt_bucket_ms = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--rewind-ticks" && i + 1 < argc) {
+            rewind_ticks = std::min<uint32_t>(max_rewind_ticks, std::max(0, std::atoi(argv[++i])));
+        } else if (arg == "--bot-threads" && i + 1 < argc) {
+            bot_threads = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--bot-budget-us" && i + 1 < argc) {
+            bot_budget_us = std::max(50, std::atoi(argv[++i]));
+        } else if (arg == "--send-budget-kb" && i + 1 < argc) {
+            send_budget_bytes = static_cast<size_t>(std::max(1, std::atoi(argv[++i]))) * 1024;
+        } else if (arg == "--send-limit-kb" && i + 1 < argc) {
+            send_limit_bytes = static_cast<size_t>(std::max(1, std::atoi(argv[++i]))) * 1024;
+        } else if (arg == "--resume-grace-s" && i + 1 < argc) {
+            resume_grace_s = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--lobby-idle-s" && i + 1 < argc) {
+            lobby_idle_s = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--finished-idle-s" && i + 1 < argc) {
+            finished_idle_s = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--idle-s" && i + 1 < argc) {
+            connection_idle_s = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--shard" && i + 1 < argc) {
+            // I/N, as tron_router passes it
+            int index = 0, count = 1;
+            if (std::sscanf(argv[++i], "%d/%d", &index, &count) == 2 && count >= 1 && index >= 0 && index < count) {
+                shard_index = index;
+                shard_count = count;
             }
-            send_message_to_room(s, room_id, "ROOM_UPDATE " + room_id + " " + std::to_string(room.players.size()) + " " + std::to_string(room.max_players));
+        } else if (arg == "--worker-port" && i + 1 < argc) {
+            worker_port = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            thread_count = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            tron_log::Level level;
+            if (tron_log::parse_level(argv[++i], level)) {
+                log.set_level(level);
+            }
+        } else if (arg == "--log-sample" && i + 1 < argc) {
+            log.set_sample_every(static_cast<unsigned>(std::max(1, std::atoi(argv[++i]))));
+        } else if (arg == "--access-log") {
+            access_log = true;
+        } else if (arg == "--record-dir" && i + 1 < argc) {
+            record_dir = argv[++i];
+        } else if (arg == "--results-db" && i + 1 < argc) {
+            results_db = argv[++i];
         }
     }
-}
-
+    send_limit_bytes = std::max(send_limit_bytes, send_budget_bytes);
+    uptime_ms(); // Starts the clock
+    log.start();
+    if (!record_dir.empty()) {
+        recorder.start(record_dir);
+        TRON_LOG(Info, "", 0, "Recording matches to %s", record_dir.c_str());
+    }
+    if (!results_db.empty()) {
+        std::string error;
+        if (results.start(results_db, error)) {
+            TRON_LOG(Info, "", 0, "Storing match results in %s", results_db.c_str());
+        } else {
+            TRON_LOG(Error, "", 0, "Cannot open results database %s: %s", results_db.c_str(), error.c_str());
+        }
+    }
+    if (bot_threads > 0) {
+        bot_pool.start(bot_threads);
+    }
 
-int main() {
     server echo_server;
 
     try {
-        // Set logging settings
-        echo_server.set_access_channels(websocketpp::log::alevel::all);
-        echo_server.clear_access_channels(websocketpp::log::alevel::frame_payload);
+        // Set logging settings. websocketpp's access log writes synchronously for every
+        // connection event, so it is off unless asked for with --access-log.
+        echo_server.clear_access_channels(websocketpp::log::alevel::all);
+        if (access_log) {
+            echo_server.set_access_channels(websocketpp::log::alevel::all);
+            echo_server.clear_access_channels(websocketpp::log::alevel::frame_payload);
+        }
 
         // Initialize Asio
         echo_server.init_asio();
 
-        // Register our message handler
-        echo_server.set_message_handler(bind(&on_message, &echo_server, ::_1, ::_2));
-        echo_server.set_close_handler(bind(&on_close, &echo_server, ::_1)); // Register on_close handler
+        // Register our handlers; on_open installs the per-connection message and close handlers
+        echo_server.set_validate_handler(bind(&on_validate, &echo_server, ::_1));
+        echo_server.set_open_handler(bind(&on_open, &echo_server, ::_1));
+        echo_server.set_http_handler(bind(&on_http, &echo_server, ::_1));
 
-        // Listen on port 9002
-        echo_server.listen(9002);
+        if (worker_port == 0) {
+            // Listen on port 9002
+            echo_server.listen(9002);
+        } else {
+            // Only the router connects; reuse_addr lets a restarted worker take its port back
+            echo_server.set_reuse_addr(true);
+            echo_server.listen("127.0.0.1", std::to_string(worker_port));
+        }
 
         // Start the server accept loop
         echo_server.start_accept();
 
-        std::cout << "WebSocket server started on port 9002" << std::endl;
+        // Quick-match pairing and lobby updates run on their own fixed tick
+        auto lobby_timer = std::make_shared<steady_timer>(echo_server.get_io_service());
+        lobby_timer->expires_after(std::chrono::milliseconds(lobby_interval_ms));
+        lobby_timer->async_wait(bind(&on_lobby_tick, &echo_server, lobby_timer, ::_1));
+
+        if (worker_port == 0) {
+            TRON_LOG(Info, "", 0, "WebSocket server started on port 9002, metrics at http://localhost:9002/metrics (tick %d ms, %d thread(s))",
+                     tick_interval_ms, thread_count);
+        } else {
+            TRON_LOG(Info, "", 0, "Shard %d/%d started on 127.0.0.1:%d (tick %d ms, %d thread(s))",
+                     shard_index, shard_count, worker_port, tick_interval_ms, thread_count);
+        }
 
-        // Start the ASIO io_service run loop
+        // Run the ASIO io_service loop on a pool of threads; per-connection and per-room
+        // strands keep the handlers of each connection and room serialized
+        std::vector<std::thread> pool;
+        for (int i = 1; i < thread_count; ++i) {
+            pool.emplace_back([&echo_server]() { echo_server.run(); });
+        }
         echo_server.run();
+        for (std::thread& t : pool) {
+            t.join();
+        }
     } catch (websocketpp::exception const & e) {
-        std::cout << e.what() << std::endl;
+        TRON_LOG(Error, "", 0, "%s", e.what());
     } catch (...) {
-        std::cout << "other exception" << std::endl;
+        TRON_LOG(Error, "", 0, "other exception");
     }
 
+    bot_pool.stop();
+    results.stop();
+    recorder.stop();
+    tron_log::logger().stop();
+
     return 0;
-}
\ No newline at end of file
+}
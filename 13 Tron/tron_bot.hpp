@@ -0,0 +1,380 @@
+#ifndef TRON_BOT_HPP
+#define TRON_BOT_HPP
+
+// Computer players for tron_server.
+//
+// A bot picks its next direction with a short search over its own moves and those of
+// the nearest opponent (who is assumed to play the reply worst for the bot, the other
+// players keep going straight), scoring positions by Voronoi territory: each free cell
+// goes to the player reaching it first, counted on the arena's bitboard (Territory), and
+// a position is worth the bot's cells minus the best opponent's. The search
+// deepens one move at a time until the deadline and answers with the last depth it
+// finished, so a decision never overruns its budget by more than one evaluation.
+//
+// Decisions run on a WorkerPool, away from the network threads and room strands. Rooms
+// hand a copy of their match to the pool after broadcasting a tick and get the turns
+// back on their strand, so a tick never waits for a bot.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tron_game.hpp"
+#include "tron_queue.hpp"
+
+namespace tron_bot {
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+// Voronoi territory: a free cell belongs to the living player whose head reaches it in
+// the fewest moves, and to nobody if two get there at once. It is a breadth-first search
+// from every head at the same time, run on bitboard rows: each player has a frontier, the
+// cells it reached last, and one step grows every frontier by a cell with shifts and
+// masks, a row word at a time, taking only cells nobody reached before. Cells two
+// frontiers reach together become a neutral frontier, which keeps spreading and blocking
+// like the players' own. Only the rows around the frontiers are visited.
+class Territory {
+public:
+    // Cells of the player in each slot, 0 for those out of the match
+    void count(const tron_game::Match& match, int counts[tron_game::MAX_PLAYERS]) {
+        if (match.arena.occupancy().stride() == 1) {
+            count_rows<1>(match, counts); // Up to 64 columns, the compiler drops the word loops
+        } else {
+            count_rows<0>(match, counts);
+        }
+    }
+
+private:
+    // Stride is the words per row, or 0 to take it from the arena
+    template <int Stride>
+    void count_rows(const tron_game::Match& match, int counts[tron_game::MAX_PLAYERS]) {
+        const tron_game::Bitboard& occupied = match.arena.occupancy();
+        const int height = occupied.height(), stride = Stride ? Stride : occupied.stride();
+        size_t plane = static_cast<size_t>(height) * stride;
+        std::fill(counts, counts + tron_game::MAX_PLAYERS, 0);
+
+        int slots[tron_game::MAX_PLAYERS];
+        int players = 0;
+        for (size_t i = 0; i < match.players.size(); ++i) {
+            if (match.players[i].alive) {
+                slots[players++] = static_cast<int>(i);
+            }
+        }
+        // Frontier planes: one per living player, then the neutral one
+        frontier.assign(plane * (players + 1), 0);
+        open.resize(plane);
+        for (int y = 0; y < height; ++y) {
+            for (int k = 0; k < stride; ++k) {
+                open[static_cast<size_t>(y) * stride + k] = ~occupied.row(y)[k] & occupied.valid(k);
+            }
+        }
+        int top = height, bottom = -1;
+        for (int s = 0; s < players; ++s) {
+            const tron_game::Player& p = match.players[slots[s]];
+            frontier[s * plane + static_cast<size_t>(p.y) * stride + (p.x >> 6)] |= uint64_t(1) << (p.x & 63);
+            top = std::min(top, p.y);
+            bottom = std::max(bottom, p.y);
+        }
+
+        // Rows are grown in place from the top down, so the row above as it was before
+        // this step is kept aside, and the new row waits in grown until all of it is done
+        above.assign(static_cast<size_t>(players + 1) * stride, 0);
+        grown.resize(above.size());
+        bool neutral = false;
+        while (top <= bottom) {
+            int first = std::max(0, top - 1), last = std::min(height - 1, bottom + 1);
+            int spreading = players + (neutral ? 1 : 0);
+            bool reaching = false;
+            neutral = false;
+            top = height;
+            bottom = -1;
+            std::fill(above.begin(), above.end(), 0); // Row first - 1 is empty
+            for (int y = first; y <= last; ++y) {
+                size_t row = static_cast<size_t>(y) * stride;
+                for (int k = 0; k < stride; ++k) {
+                    uint64_t reachable = open[row + k], seen = 0, twice = 0;
+                    for (int s = 0; s < spreading; ++s) {
+                        const uint64_t* f = &frontier[s * plane + row];
+                        uint64_t c = f[k];
+                        uint64_t next = c | c << 1 | c >> 1 | above[s * stride + k];
+                        if (k > 0) next |= f[k - 1] >> 63;
+                        if (k + 1 < stride) next |= f[k + 1] << 63;
+                        if (y + 1 < height) next |= f[k + stride];
+                        next &= reachable;
+                        grown[s * stride + k] = next;
+                        twice |= seen & next;
+                        seen |= next;
+                    }
+                    if (spreading == players) {
+                        grown[players * stride + k] = 0;
+                    }
+                    grown[players * stride + k] |= twice;
+                    open[row + k] = reachable & ~seen;
+                    for (int s = 0; s < players; ++s) {
+                        grown[s * stride + k] &= ~twice;
+                        counts[slots[s]] += tron_game::popcount64(grown[s * stride + k]);
+                    }
+                }
+                for (int s = 0; s <= players; ++s) {
+                    uint64_t* f = &frontier[s * plane + row];
+                    for (int k = 0; k < stride; ++k) {
+                        above[s * stride + k] = f[k];
+                        f[k] = grown[s * stride + k];
+                        if (f[k] != 0) {
+                            (s < players ? reaching : neutral) = true;
+                            top = std::min(top, y);
+                            bottom = std::max(bottom, y);
+                        }
+                    }
+                }
+            }
+            if (!reaching) {
+                break; // What is left only goes to the neutral frontier
+            }
+        }
+    }
+
+    std::vector<uint64_t> frontier;    // Plane per player and a neutral one, like the occupancy
+    std::vector<uint64_t> open;        // Free cells nobody reached yet
+    std::vector<uint64_t> above, grown; // One row per plane, see count()
+};
+
+class Planner {
+public:
+    // The direction the player in slot should take next, or its current one if nothing
+    // is better. Gives up deepening at deadline.
+    int choose(const tron_game::Match& match, int slot, Deadline deadline) {
+        const tron_game::Player& me = match.players[slot];
+        this->deadline = deadline;
+        this->slot = slot;
+        opponent = nearest_opponent(match, slot);
+        evaluations = 0;
+
+        int best = me.dir;
+        for (int depth = 1; depth <= MAX_DEPTH; ++depth) {
+            timed_out = false;
+            int best_at_depth = me.dir;
+            int best_score = LOSS - 1;
+            for (int dir : moves(me.dir)) {
+                int score = reply(match, dir, depth);
+                if (timed_out) {
+                    break;
+                }
+                if (score > best_score) {
+                    best_score = score;
+                    best_at_depth = dir;
+                }
+            }
+            if (timed_out) {
+                break; // Keep the answer of the last complete depth
+            }
+            best = best_at_depth;
+            if (best_score >= WIN || best_score <= LOSS) {
+                break; // Decided whatever we search further
+            }
+        }
+        return best;
+    }
+
+    // Positions scored by the last choose()
+    int evaluation_count() const {
+        return evaluations;
+    }
+
+private:
+    static const int MAX_DEPTH = 6;
+    static const int WIN = 1000000;
+    static const int LOSS = -1000000;
+
+    struct Moves {
+        int dirs[3];
+        const int* begin() const { return dirs; }
+        const int* end() const { return dirs + 3; }
+    };
+
+    // Every direction but the reversal
+    static Moves moves(int dir) {
+        Moves m;
+        int n = 0;
+        for (int d = 0; d < 4; ++d) {
+            if (d != (dir + 2) % 4) {
+                m.dirs[n++] = d;
+            }
+        }
+        return m;
+    }
+
+    static int nearest_opponent(const tron_game::Match& match, int slot) {
+        const tron_game::Player& me = match.players[slot];
+        int nearest = -1, nearest_distance = 0;
+        for (size_t i = 0; i < match.players.size(); ++i) {
+            const tron_game::Player& p = match.players[i];
+            if (static_cast<int>(i) == slot || !p.alive) continue;
+            int distance = std::abs(p.x - me.x) + std::abs(p.y - me.y);
+            if (nearest < 0 || distance < nearest_distance) {
+                nearest = static_cast<int>(i);
+                nearest_distance = distance;
+            }
+        }
+        return nearest;
+    }
+
+    // Our move dir answered by the opponent's worst reply for us
+    int reply(const tron_game::Match& match, int dir, int depth) {
+        if (opponent < 0) {
+            tron_game::Match next = match;
+            next.turn(slot, dir);
+            next.step();
+            return search(next, depth - 1);
+        }
+        int worst = WIN + 1;
+        for (int answer : moves(match.players[opponent].dir)) {
+            tron_game::Match next = match;
+            next.turn(slot, dir);
+            next.turn(opponent, answer);
+            next.step();
+            int score = search(next, depth - 1);
+            if (timed_out) {
+                return 0;
+            }
+            if (score < worst) {
+                worst = score;
+                if (worst <= LOSS) {
+                    break;
+                }
+            }
+        }
+        return worst;
+    }
+
+    int search(const tron_game::Match& match, int depth) {
+        const tron_game::Player& me = match.players[slot];
+        if (!me.alive) {
+            return LOSS;
+        }
+        if (match.alive_count() == 1) {
+            return WIN;
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            timed_out = true;
+            return 0;
+        }
+        if (depth == 0 || (opponent >= 0 && !match.players[opponent].alive)) {
+            return territory(match);
+        }
+        int best = LOSS - 1;
+        for (int dir : moves(me.dir)) {
+            int score = reply(match, dir, depth);
+            if (timed_out) {
+                return 0;
+            }
+            best = std::max(best, score);
+        }
+        return best;
+    }
+
+    // Our Voronoi cells minus those of the strongest opponent
+    int territory(const tron_game::Match& match) {
+        ++evaluations;
+        int counts[tron_game::MAX_PLAYERS];
+        voronoi.count(match, counts);
+        int best_other = 0;
+        for (size_t i = 0; i < match.players.size(); ++i) {
+            if (static_cast<int>(i) != slot) {
+                best_other = std::max(best_other, counts[i]);
+            }
+        }
+        return counts[slot] - best_other;
+    }
+
+    Deadline deadline;
+    int slot = 0;
+    int opponent = -1;
+    bool timed_out = false;
+    int evaluations = 0;
+    Territory voronoi;
+};
+
+// Fixed set of threads running jobs from a bounded lock-free queue. submit() never
+// blocks: when the queue is full the job is refused and the caller carries on without it.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t capacity = 4096) : jobs(capacity) {}
+
+    ~WorkerPool() {
+        stop();
+    }
+
+    void start(int threads) {
+        if (running.exchange(true)) {
+            return;
+        }
+        for (int i = 0; i < threads; ++i) {
+            workers.emplace_back(&WorkerPool::run, this);
+        }
+    }
+
+    // Finishes the jobs already queued, then joins the threads
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        wakeup.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    bool enabled() const {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    bool submit(std::function<void()> job) {
+        if (!enabled() || !jobs.try_push_with([&](std::function<void()>& slot) { slot = std::move(job); })) {
+            return false;
+        }
+        if (idle.load(std::memory_order_acquire) > 0) {
+            wakeup.notify_one();
+        }
+        return true;
+    }
+
+private:
+    void run() {
+        std::function<void()> job;
+        for (;;) {
+            if (jobs.try_pop(job)) {
+                job();
+                job = nullptr;
+                continue;
+            }
+            if (!running.load(std::memory_order_acquire)) {
+                return;
+            }
+            // A push racing with the idle count is picked up at the latest on the timeout
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.fetch_add(1, std::memory_order_acq_rel);
+            wakeup.wait_for(lock, std::chrono::milliseconds(2));
+            idle.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    tron_queue::MpmcQueue<std::function<void()>> jobs;
+    std::vector<std::thread> workers;
+    std::atomic<bool> running{false};
+    std::atomic<int> idle{0};
+    std::mutex mutex;
+    std::condition_variable wakeup;
+};
+
+} // namespace tron_bot
+
+#endif // TRON_BOT_HPP
@@ -0,0 +1,289 @@
+#ifndef TRON_GAME_HPP
+#define TRON_GAME_HPP
+
+// Tron rules without SFML, shared by the client, tron_server and tron_bench.
+//
+// Up to MAX_PLAYERS light cycles move one cell per tick and leave a trail behind. The
+// arena keeps its occupancy as a bitboard of packed 64-bit rows, which is all collisions
+// look at, and a byte per cell naming the trail's owner, which only drawing and
+// keyframes read. At the usual 60 columns a row is a single word, so searches such as
+// the bots' territory count can shift and merge whole rows at a time.
+//
+// A tick costs O(players) whatever the arena size: every head tests one bit, and heads
+// meeting in the same free cell are found by claiming the cell as they move in, so the
+// second head to arrive sees the bit of the first.
+//
+// The rules use nothing but positions, directions and the arena, so two matches given the
+// same turns stay identical; checksum() lets lockstep clients verify that cheaply.
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tron_game {
+
+const int MAX_PLAYERS = 16;
+
+// Directions, as sent in INPUT and state frames
+enum Dir { DOWN = 0, LEFT = 1, UP = 2, RIGHT = 3 };
+
+struct Player {
+    int x, y, dir;
+    bool alive;
+};
+
+// Number of set bits
+inline int popcount64(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(v);
+#else
+    v = v - ((v >> 1) & 0x5555555555555555ULL);
+    v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+    v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<int>((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// Set of cells of a width x height grid, one bit per cell in packed rows: row y is
+// stride() words, and cell (x, y) is bit x % 64 of its word x / 64. Bits past the last
+// column are always 0.
+class Bitboard {
+public:
+    Bitboard(int width, int height)
+        : w(width), h(height), words((width + 63) / 64), bits(static_cast<size_t>(words) * height),
+          last_mask(width % 64 == 0 ? ~uint64_t(0) : (uint64_t(1) << (width % 64)) - 1) {}
+
+    int width() const { return w; }
+    int height() const { return h; }
+    int stride() const { return words; }
+
+    bool test(int x, int y) const {
+        return (bits[index(x, y)] >> (x & 63)) & 1;
+    }
+
+    void set(int x, int y) {
+        bits[index(x, y)] |= uint64_t(1) << (x & 63);
+    }
+
+    void reset(int x, int y) {
+        bits[index(x, y)] &= ~(uint64_t(1) << (x & 63));
+    }
+
+    void clear() {
+        std::fill(bits.begin(), bits.end(), 0);
+    }
+
+    const uint64_t* row(int y) const {
+        return &bits[static_cast<size_t>(y) * words];
+    }
+
+    // Bits of word k of a row that are cells of the grid
+    uint64_t valid(int k) const {
+        return k == words - 1 ? last_mask : ~uint64_t(0);
+    }
+
+    int count() const {
+        int n = 0;
+        for (uint64_t word : bits) {
+            n += popcount64(word);
+        }
+        return n;
+    }
+
+private:
+    size_t index(int x, int y) const {
+        return static_cast<size_t>(y) * words + (x >> 6);
+    }
+
+    int w, h, words;
+    std::vector<uint64_t> bits;
+    uint64_t last_mask; // Cells of the last word of a row
+};
+
+class Arena {
+public:
+    Arena(int width, int height) : w(width), h(height), cells(width, height), owners(static_cast<size_t>(width) * height) {}
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    bool inside(int x, int y) const {
+        return x >= 0 && x < w && y >= 0 && y < h;
+    }
+
+    bool occupied(int x, int y) const {
+        return cells.test(x, y);
+    }
+
+    // Every occupied cell, for searches that work on whole rows
+    const Bitboard& occupancy() const {
+        return cells;
+    }
+
+    // Owner of a cell, 0 when empty, otherwise player slot + 1
+    int owner(int x, int y) const {
+        return owners[index(x, y)];
+    }
+
+    void mark(int x, int y, int owner) {
+        size_t cell = index(x, y);
+        digest ^= cell_key(cell, owners[cell]) ^ cell_key(cell, owner);
+        cells.set(x, y);
+        owners[cell] = static_cast<uint8_t>(owner);
+    }
+
+    void clear(int x, int y) {
+        size_t cell = index(x, y);
+        digest ^= cell_key(cell, owners[cell]);
+        cells.reset(x, y);
+        owners[cell] = 0;
+    }
+
+    void reset() {
+        cells.clear();
+        std::fill(owners.begin(), owners.end(), 0);
+        digest = 0;
+    }
+
+    // Hash of every cell's owner, kept up to date by mark() and clear() in O(1)
+    uint64_t hash() const {
+        return digest;
+    }
+
+private:
+    size_t index(int x, int y) const {
+        return static_cast<size_t>(y) * w + x;
+    }
+
+    // Random-looking key of an owned cell (splitmix64 finaliser), empty cells hash to 0
+    static uint64_t cell_key(size_t cell, int owner) {
+        if (owner == 0) {
+            return 0;
+        }
+        uint64_t z = (static_cast<uint64_t>(cell) << 5 | static_cast<uint64_t>(owner)) + 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    int w, h;
+    uint64_t digest = 0;
+    Bitboard cells;              // Occupancy
+    std::vector<uint8_t> owners; // Row-major
+};
+
+class Match {
+public:
+    Match(int width, int height) : arena(width, height) {}
+
+    // Place count players at their start positions on an empty arena. Even slots start
+    // on the left moving right, odd slots on the right moving left, spread evenly down
+    // the arena; two players start where the original game put them.
+    void reset(int count) {
+        arena.reset();
+        players.assign(static_cast<size_t>(count), Player());
+        int per_side = (count + 1) / 2;
+        for (int slot = 0; slot < count; ++slot) {
+            Player& p = players[slot];
+            bool left = slot % 2 == 0;
+            p.x = left ? 10 : arena.width() - 11;
+            p.y = (slot / 2 + 1) * arena.height() / (per_side + 1);
+            p.dir = left ? RIGHT : LEFT;
+            p.alive = true;
+            arena.mark(p.x, p.y, slot + 1);
+        }
+    }
+
+    // Turn a player, ignoring reversals into its own trail
+    void turn(int slot, int dir) {
+        Player& p = players[slot];
+        if (p.alive && dir >= 0 && dir <= 3 && dir != (p.dir + 2) % 4) {
+            p.dir = dir;
+        }
+    }
+
+    // Take a player out of the match, its trail stays
+    void eliminate(int slot) {
+        players[slot].alive = false;
+    }
+
+    // Move every living player one cell. Heads leaving the arena or entering a trail
+    // crash, heads entering the same free cell crash into each other and leave it empty.
+    // Returns false once at most one player is left.
+    bool step() {
+        bool crashed[MAX_PLAYERS] = {false};
+        bool head_on[MAX_PLAYERS] = {false};
+        int count = static_cast<int>(players.size());
+        for (int i = 0; i < count; ++i) {
+            Player& p = players[i];
+            if (!p.alive) continue;
+            if (p.dir == DOWN) p.y += 1;
+            if (p.dir == LEFT) p.x -= 1;
+            if (p.dir == UP) p.y -= 1;
+            if (p.dir == RIGHT) p.x += 1;
+            crashed[i] = !arena.inside(p.x, p.y) || arena.occupied(p.x, p.y);
+        }
+        // Claim the cells the others moved into; a claimed cell means a head-on collision
+        for (int i = 0; i < count; ++i) {
+            const Player& p = players[i];
+            if (!p.alive || crashed[i]) continue;
+            if (arena.occupied(p.x, p.y)) {
+                head_on[i] = true;
+                head_on[arena.owner(p.x, p.y) - 1] = true;
+            } else {
+                arena.mark(p.x, p.y, i + 1);
+            }
+        }
+        for (int i = 0; i < count; ++i) {
+            Player& p = players[i];
+            if (head_on[i] && arena.owner(p.x, p.y) == i + 1) {
+                arena.clear(p.x, p.y);
+            }
+            if (crashed[i] || head_on[i]) {
+                p.alive = false;
+            }
+        }
+        return !over();
+    }
+
+    int alive_count() const {
+        int alive = 0;
+        for (const Player& p : players) {
+            alive += p.alive ? 1 : 0;
+        }
+        return alive;
+    }
+
+    bool over() const {
+        return alive_count() <= 1;
+    }
+
+    // 32-bit digest of the arena and the living players. Where a dead player stopped is
+    // left out, state frames do not carry it.
+    uint32_t checksum() const {
+        uint64_t h = arena.hash();
+        for (const Player& p : players) {
+            uint64_t v = p.alive ? (static_cast<uint64_t>(p.x) << 20 | static_cast<uint64_t>(p.y) << 4 | static_cast<uint64_t>(p.dir) << 1 | 1) : 0;
+            h = (h ^ v) * 0x100000001B3ULL; // FNV-1a step
+        }
+        return static_cast<uint32_t>(h ^ (h >> 32));
+    }
+
+    // Result text of a finished match
+    std::string result() const {
+        for (size_t slot = 0; slot < players.size(); ++slot) {
+            if (players[slot].alive) {
+                return "Player " + std::to_string(slot + 1) + " Wins!";
+            }
+        }
+        return "It's a Draw!";
+    }
+
+    Arena arena;
+    std::vector<Player> players;
+};
+
+} // namespace tron_game
+
+#endif // TRON_GAME_HPP
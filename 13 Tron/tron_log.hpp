@@ -0,0 +1,209 @@
+#ifndef TRON_LOG_HPP
+#define TRON_LOG_HPP
+
+// Asynchronous logger for tron_server.
+//
+// Handlers format an entry into a slot of a lock-free ring and return. A background
+// thread drains the ring and writes to stdout in batches. When the ring is full the
+// entry is dropped and counted, so logging never blocks a network or room handler.
+//
+// Entries carry structured fields (room id, connection id) and come out as logfmt:
+//   ts=2026-01-01T12:00:00.123Z level=info room=AB12CD conn=42 msg="Game started"
+//
+// Use the TRON_LOG macros, which skip formatting when the level is disabled.
+// TRON_LOG_SAMPLED additionally keeps only one in --log-sample N entries, for
+// per-message logs.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+
+#include "tron_queue.hpp"
+
+namespace tron_log {
+
+enum Level { Debug = 0, Info = 1, Warn = 2, Error = 3, Off = 4 };
+
+inline const char* level_name(Level level) {
+    static const char* names[] = {"debug", "info", "warn", "error", "off"};
+    return names[level];
+}
+
+inline bool parse_level(const std::string& name, Level& level) {
+    for (int l = Debug; l <= Off; ++l) {
+        if (name == level_name(static_cast<Level>(l))) {
+            level = static_cast<Level>(l);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Entry {
+    Level level;
+    int64_t time_ms;  // Unix time
+    char room[8];     // Room id or empty
+    uint64_t conn;    // Connection id or 0
+    char text[216];
+};
+
+class Logger {
+public:
+    Logger() : queue(8192) {}
+
+    ~Logger() {
+        stop();
+    }
+
+    void start() {
+        if (!running.exchange(true)) {
+            drain_thread = std::thread(&Logger::drain, this);
+        }
+    }
+
+    // Writes out everything queued so far and stops the drain thread
+    void stop() {
+        if (running.exchange(false)) {
+            drain_thread.join();
+        }
+    }
+
+    void set_level(Level level) {
+        min_level.store(level, std::memory_order_relaxed);
+    }
+
+    Level level() const {
+        return min_level.load(std::memory_order_relaxed);
+    }
+
+    void set_sample_every(unsigned n) {
+        sample_every.store(n > 0 ? n : 1, std::memory_order_relaxed);
+    }
+
+    bool enabled(Level level) const {
+        return level >= min_level.load(std::memory_order_relaxed);
+    }
+
+    // True for one call in sample_every
+    bool sampled() {
+        unsigned n = sample_every.load(std::memory_order_relaxed);
+        return n <= 1 || sample_counter.fetch_add(1, std::memory_order_relaxed) % n == 0;
+    }
+
+    uint64_t dropped() const {
+        return dropped_entries.load(std::memory_order_relaxed);
+    }
+
+    void write(Level level, const std::string& room, uint64_t conn, const char* format, ...)
+        __attribute__((format(printf, 5, 6))) {
+        va_list args;
+        va_start(args, format);
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        bool queued = queue.try_push_with([&](Entry& entry) {
+            entry.level = level;
+            entry.time_ms = now;
+            size_t room_length = std::min(room.size(), sizeof(entry.room) - 1);
+            std::memcpy(entry.room, room.data(), room_length);
+            entry.room[room_length] = '\0';
+            entry.conn = conn;
+            std::vsnprintf(entry.text, sizeof(entry.text), format, args);
+        });
+        va_end(args);
+        if (!queued) {
+            dropped_entries.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    void drain() {
+        std::string batch;
+        batch.reserve(1 << 16);
+        Entry entry;
+        uint64_t reported_drops = 0;
+        for (;;) {
+            bool stopping = !running.load(std::memory_order_acquire);
+            while (batch.size() < (1 << 16) && queue.try_pop(entry)) {
+                format(entry, batch);
+            }
+            uint64_t drops = dropped();
+            if (drops != reported_drops) {
+                batch += "level=warn msg=\"log ring full, dropped " + std::to_string(drops - reported_drops) + " entries\"\n";
+                reported_drops = drops;
+            }
+            if (!batch.empty()) {
+                std::fwrite(batch.data(), 1, batch.size(), stdout);
+                std::fflush(stdout);
+                batch.clear();
+                continue;
+            }
+            if (stopping) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+
+    static void format(const Entry& entry, std::string& out) {
+        char prefix[96];
+        std::time_t seconds = static_cast<std::time_t>(entry.time_ms / 1000);
+        std::tm utc;
+        gmtime_r(&seconds, &utc);
+        size_t n = std::strftime(prefix, sizeof(prefix), "ts=%Y-%m-%dT%H:%M:%S", &utc);
+        std::snprintf(prefix + n, sizeof(prefix) - n, ".%03dZ level=%s",
+                      static_cast<int>(entry.time_ms % 1000), level_name(entry.level));
+        out += prefix;
+        if (entry.room[0] != '\0') {
+            out += " room=";
+            out += entry.room;
+        }
+        if (entry.conn != 0) {
+            out += " conn=";
+            out += std::to_string(entry.conn);
+        }
+        out += " msg=\"";
+        for (const char* p = entry.text; *p; ++p) {
+            if (*p == '"' || *p == '\\') {
+                out += '\\';
+            }
+            out += (*p == '\n') ? ' ' : *p;
+        }
+        out += "\"\n";
+    }
+
+    tron_queue::MpmcQueue<Entry> queue;
+    std::thread drain_thread;
+    std::atomic<bool> running{false};
+    std::atomic<Level> min_level{Info};
+    std::atomic<unsigned> sample_every{1};
+    std::atomic<unsigned> sample_counter{0};
+    std::atomic<uint64_t> dropped_entries{0};
+};
+
+inline Logger& logger() {
+    static Logger instance;
+    return instance;
+}
+
+} // namespace tron_log
+
+#define TRON_LOG(level, room, conn, ...) \
+    do { \
+        if (tron_log::logger().enabled(tron_log::level)) \
+            tron_log::logger().write(tron_log::level, room, conn, __VA_ARGS__); \
+    } while (0)
+
+#define TRON_LOG_SAMPLED(level, room, conn, ...) \
+    do { \
+        if (tron_log::logger().enabled(tron_log::level) && tron_log::logger().sampled()) \
+            tron_log::logger().write(tron_log::level, room, conn, __VA_ARGS__); \
+    } while (0)
+
+#endif // TRON_LOG_HPP
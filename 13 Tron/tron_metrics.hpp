@@ -0,0 +1,104 @@
+#ifndef TRON_METRICS_HPP
+#define TRON_METRICS_HPP
+
+// Counters, gauges and histograms for tron_server, rendered in the Prometheus text
+// exposition format. Updates are relaxed atomic operations on cache-line aligned values
+// so that recording from every thread of the pool stays cheap.
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+namespace tron_metrics {
+
+class alignas(64) Counter {
+public:
+    void add(uint64_t n = 1) {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+class alignas(64) Gauge {
+public:
+    void add(int64_t n) {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void set(int64_t n) {
+        value.store(n, std::memory_order_relaxed);
+    }
+
+    int64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> value{0};
+};
+
+// Latency histogram with fixed buckets from 10 us to 1 s
+class Histogram {
+public:
+    static const int BUCKETS = 16;
+
+    void observe_ns(uint64_t ns) {
+        int i = 0;
+        while (i < BUCKETS && ns > bound_ns(i)) {
+            ++i;
+        }
+        counts[i].fetch_add(1, std::memory_order_relaxed);
+        sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    // Bucket upper bounds: 10, 25, 50, 100, 250, 500 us ... 1 s
+    static uint64_t bound_ns(int i) {
+        static const uint64_t bounds[BUCKETS] = {
+            10000, 25000, 50000, 100000, 250000, 500000,
+            1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+            100000000, 250000000, 500000000, 1000000000
+        };
+        return bounds[i];
+    }
+
+    void render(std::ostream& out, const std::string& name, const std::string& help) const {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            cumulative += counts[i].load(std::memory_order_relaxed);
+            out << name << "_bucket{le=\"" << bound_ns(i) / 1e9 << "\"} " << cumulative << "\n";
+        }
+        cumulative += counts[BUCKETS].load(std::memory_order_relaxed);
+        out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+        out << name << "_sum " << sum_ns.load(std::memory_order_relaxed) / 1e9 << "\n";
+        out << name << "_count " << cumulative << "\n";
+    }
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS + 1] = {};
+    alignas(64) std::atomic<uint64_t> sum_ns{0};
+};
+
+inline void render_counter(std::ostream& out, const std::string& name, const std::string& help, uint64_t value) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " counter\n";
+    out << name << " " << value << "\n";
+}
+
+inline void render_gauge(std::ostream& out, const std::string& name, const std::string& help, int64_t value) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " gauge\n";
+    out << name << " " << value << "\n";
+}
+
+} // namespace tron_metrics
+
+#endif // TRON_METRICS_HPP
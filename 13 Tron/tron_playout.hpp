@@ -0,0 +1,149 @@
+#ifndef TRON_PLAYOUT_HPP
+#define TRON_PLAYOUT_HPP
+
+// Adaptive playout (jitter) buffer for the ticks of an online match, used by the client.
+//
+// Ticks are sent at a fixed interval but arrive with varying delay. Applying each one as
+// it arrives shows that variation as stutter, so the buffer holds them and hands them
+// out on a steady clock instead: tick t plays at t * tick_ms + offset, where offset is the
+// mean transit time (arrival minus t * tick_ms) plus a safety delay. The delay follows
+// the measured jitter, the RFC 3550 interarrival estimate (the mean change in transit
+// time from one tick to the next), so a quiet connection plays almost at once and a
+// jittery one waits just long enough for most ticks to be on time. The offset slews
+// toward its target by at most a few percent of elapsed time, so the clock never jumps.
+//
+// Between two ticks, progress() tells how far the clock has moved from the last tick
+// handed out toward the next one, for interpolating what is drawn.
+//
+// Not thread-safe: one thread pushes and pops.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace tron_playout {
+
+template <typename T>
+class PlayoutBuffer {
+public:
+    explicit PlayoutBuffer(double tick_ms = 50) {
+        reset(tick_ms);
+    }
+
+    void reset(double tick_ms) {
+        this->tick_ms = std::max(1.0, tick_ms);
+        entries.clear();
+        started = false;
+        jitter = this->tick_ms / 4; // Until measured, some jitter is likelier than none
+        last_tick = 0;
+    }
+
+    // Times are milliseconds on any steady clock, the same for push and pop
+    void push(uint32_t tick, double arrival_ms, T item) {
+        double transit = arrival_ms - tick * tick_ms;
+        if (!started) {
+            started = true;
+            mean_transit = last_transit = transit;
+            offset = target_offset();
+            last_now = arrival_ms;
+        } else {
+            jitter += (std::abs(transit - last_transit) - jitter) / 16;
+            // A tick that missed its playout time means the estimate is short, by at least half that
+            double late = transit - offset;
+            if (late > 0) {
+                jitter += late / 2;
+            }
+            mean_transit += (transit - mean_transit) / 32;
+            last_transit = transit;
+        }
+        entries.push_back(Entry{tick, std::move(item)});
+    }
+
+    // The next tick whose time has come, oldest first. A buffer holding more than
+    // MAX_DEPTH ticks has fallen behind and lets the oldest go at once.
+    bool pop(double now_ms, T& item) {
+        advance(now_ms);
+        if (entries.empty()) {
+            return false;
+        }
+        if (entries.front().tick > playout_tick() && entries.size() <= MAX_DEPTH) {
+            return false;
+        }
+        item = std::move(entries.front().item);
+        last_tick = entries.front().tick;
+        entries.pop_front();
+        return true;
+    }
+
+    // Everything still buffered, as a match event that must not wait needs
+    bool pop_any(T& item) {
+        if (entries.empty()) {
+            return false;
+        }
+        item = std::move(entries.front().item);
+        last_tick = entries.front().tick;
+        entries.pop_front();
+        return true;
+    }
+
+    // The tick after the last one handed out, if it has arrived
+    const T* next() const {
+        return entries.empty() ? nullptr : &entries.front().item;
+    }
+
+    // Fraction of the way from the last tick handed out to the next one, 0 to 1
+    double progress() const {
+        return std::min(1.0, std::max(0.0, playout_tick() - last_tick));
+    }
+
+    // Safety delay the buffer settled on, over the mean transit time
+    double delay_ms() const {
+        return std::min(MAX_DELAY_TICKS * tick_ms, JITTER_MULTIPLE * jitter + MIN_DELAY_MS);
+    }
+
+private:
+    static constexpr double JITTER_MULTIPLE = 2.0; // About 99% of ticks on time for normal jitter
+    static constexpr double MIN_DELAY_MS = 4;      // Room for the render loop's own timing
+    static constexpr double MAX_DELAY_TICKS = 4;
+    static constexpr double SLEW = 0.05;           // Offset change per ms of elapsed time, at most
+    static const size_t MAX_DEPTH = 16;
+
+    struct Entry {
+        uint32_t tick;
+        T item;
+    };
+
+    double target_offset() const {
+        return mean_transit + delay_ms();
+    }
+
+    void advance(double now_ms) {
+        if (!started) {
+            return;
+        }
+        double elapsed = std::max(0.0, now_ms - last_now);
+        double change = target_offset() - offset;
+        offset += std::max(-SLEW * elapsed, std::min(SLEW * elapsed, change));
+        last_now = now_ms;
+    }
+
+    double playout_tick() const {
+        return (last_now - offset) / tick_ms;
+    }
+
+    double tick_ms = 50;
+    std::deque<Entry> entries;
+    bool started = false;
+    double mean_transit = 0;
+    double last_transit = 0;
+    double jitter = 0;
+    double offset = 0;   // Playout time of tick t is t * tick_ms + offset
+    double last_now = 0;
+    uint32_t last_tick = 0;
+};
+
+} // namespace tron_playout
+
+#endif // TRON_PLAYOUT_HPP
@@ -0,0 +1,215 @@
+#ifndef TRON_PROTOCOL_HPP
+#define TRON_PROTOCOL_HPP
+
+// Binary state frames for online Tron.
+//
+// A client that offers the "tron.bin.v1" websocket subprotocol at connect time gets
+// the per-tick state as binary frames instead of text TICK lines. Control messages
+// (ROOM_CREATED, GAME_START, GAME_OVER, ...) stay text.
+//
+// Every frame starts with a type byte and the tick number as a varint:
+//   DELTA:    [type][tick][head count] then per head [cell index varint][dir | alive << 2]
+//   KEYFRAME: same as DELTA, followed by [width][height] and the owner map as
+//             run-length varints ((run_length << 5) | owner), row-major
+//   STEP:     [type][tick][player count] then the direction each player moved in,
+//             four to a byte, and the match checksum after the tick as 4 bytes
+//             little-endian. Lockstep rooms send these instead of heads. Players who
+//             left the match since the previous tick follow as a varint with a bit
+//             per slot, only when there are any; they are out before the tick is played.
+//
+// Only the heads move in Tron and every head marks the cell it enters, so a delta's
+// changed cells are exactly its head cells. Keyframes are sent periodically so that
+// a client can always resynchronise the whole field.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tron_protocol {
+
+const char* const SUBPROTOCOL = "tron.bin.v1";
+
+enum FrameType : uint8_t {
+    FRAME_KEYFRAME = 1,
+    FRAME_DELTA = 2,
+    FRAME_STEP = 3
+};
+
+// One full keyframe every KEYFRAME_INTERVAL ticks
+const uint32_t KEYFRAME_INTERVAL = 64;
+
+struct Head {
+    int x, y, dir;
+    bool alive;
+};
+
+struct Frame {
+    FrameType type;
+    uint32_t tick;
+    std::vector<Head> heads;
+    int width = 0, height = 0;
+    std::vector<uint8_t> cells; // Owner of each cell, row-major, keyframes only (0 = empty)
+    std::vector<int> dirs;      // STEP only
+    uint32_t checksum = 0;      // STEP only
+    uint32_t out = 0;           // STEP only, bit per slot taken out of the match before the tick
+};
+
+inline void put_varint(std::string& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+inline bool get_varint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= static_cast<uint32_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void put_header(std::string& out, FrameType type, uint32_t tick, int width, const std::vector<Head>& heads) {
+    out.push_back(static_cast<char>(type));
+    put_varint(out, tick);
+    put_varint(out, static_cast<uint32_t>(heads.size()));
+    for (const Head& h : heads) {
+        put_varint(out, h.alive ? static_cast<uint32_t>(h.y * width + h.x) : 0);
+        out.push_back(static_cast<char>((h.dir & 3) | (h.alive ? 4 : 0)));
+    }
+}
+
+inline std::string encode_delta(uint32_t tick, int width, const std::vector<Head>& heads) {
+    std::string out;
+    out.reserve(4 + heads.size() * 3);
+    put_header(out, FRAME_DELTA, tick, width, heads);
+    return out;
+}
+
+inline std::string encode_step(uint32_t tick, const std::vector<int>& dirs, uint32_t checksum, uint32_t out_slots = 0) {
+    std::string out;
+    out.push_back(static_cast<char>(FRAME_STEP));
+    put_varint(out, tick);
+    put_varint(out, static_cast<uint32_t>(dirs.size()));
+    for (size_t i = 0; i < dirs.size(); i += 4) {
+        uint8_t packed = 0;
+        for (size_t j = i; j < i + 4 && j < dirs.size(); ++j) {
+            packed |= static_cast<uint8_t>((dirs[j] & 3) << (2 * (j - i)));
+        }
+        out.push_back(static_cast<char>(packed));
+    }
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<char>((checksum >> shift) & 0xFF));
+    }
+    if (out_slots != 0) {
+        put_varint(out, out_slots);
+    }
+    return out;
+}
+
+// owner_at(x, y) returns the owner of a cell (0 = empty, otherwise player slot + 1)
+template <typename OwnerAt>
+std::string encode_keyframe(uint32_t tick, int width, int height, const std::vector<Head>& heads, OwnerAt owner_at) {
+    std::string out;
+    put_header(out, FRAME_KEYFRAME, tick, width, heads);
+    put_varint(out, static_cast<uint32_t>(width));
+    put_varint(out, static_cast<uint32_t>(height));
+
+    uint32_t run = 0;
+    uint32_t current = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint32_t owner = static_cast<uint32_t>(owner_at(x, y)) & 0x1F;
+            if (run > 0 && owner != current) {
+                put_varint(out, (run << 5) | current);
+                run = 0;
+            }
+            current = owner;
+            ++run;
+        }
+    }
+    if (run > 0) {
+        put_varint(out, (run << 5) | current);
+    }
+    return out;
+}
+
+// width is the arena width the receiver expects, used to turn cell indexes back into coordinates
+inline bool decode_frame(const std::string& data, int width, Frame& frame) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data());
+    const uint8_t* end = p + data.size();
+    if (p == end) {
+        return false;
+    }
+
+    uint8_t type = *p++;
+    if (type != FRAME_KEYFRAME && type != FRAME_DELTA && type != FRAME_STEP) {
+        return false;
+    }
+    frame.type = static_cast<FrameType>(type);
+
+    uint32_t count;
+    if (!get_varint(p, end, frame.tick) || !get_varint(p, end, count) || count > 255) {
+        return false;
+    }
+
+    if (frame.type == FRAME_STEP) {
+        if (static_cast<size_t>(end - p) < (count + 3) / 4 + 4) {
+            return false;
+        }
+        frame.heads.clear();
+        frame.cells.clear();
+        frame.dirs.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            frame.dirs[i] = (p[i / 4] >> (2 * (i % 4))) & 3;
+        }
+        p += (count + 3) / 4;
+        frame.checksum = static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+                         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+        p += 4;
+        frame.out = 0;
+        return p == end || (get_varint(p, end, frame.out) && p == end);
+    }
+
+    frame.heads.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t cell;
+        if (!get_varint(p, end, cell) || p == end) {
+            return false;
+        }
+        frame.heads[i].x = static_cast<int>(cell % width);
+        frame.heads[i].y = static_cast<int>(cell / width);
+        uint8_t bits = *p++;
+        frame.heads[i].dir = bits & 3;
+        frame.heads[i].alive = (bits & 4) != 0;
+    }
+
+    frame.cells.clear();
+    if (frame.type == FRAME_KEYFRAME) {
+        uint32_t w, h;
+        if (!get_varint(p, end, w) || !get_varint(p, end, h) || static_cast<int>(w) != width || h > 1024) {
+            return false;
+        }
+        frame.width = static_cast<int>(w);
+        frame.height = static_cast<int>(h);
+        frame.cells.reserve(w * h);
+        while (frame.cells.size() < w * h) {
+            uint32_t run;
+            if (!get_varint(p, end, run) || (run >> 5) > w * h - frame.cells.size()) {
+                return false;
+            }
+            frame.cells.insert(frame.cells.end(), run >> 5, static_cast<uint8_t>(run & 0x1F));
+        }
+    }
+
+    return true;
+}
+
+} // namespace tron_protocol
+
+#endif // TRON_PROTOCOL_HPP
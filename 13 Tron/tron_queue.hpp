@@ -0,0 +1,150 @@
+#ifndef TRON_QUEUE_HPP
+#define TRON_QUEUE_HPP
+
+// Bounded lock-free queues for handing work between threads. A full queue makes
+// try_push fail instead of blocking.
+//
+// MpmcQueue, from the server's threads to a background thread, is multi-producer
+// multi-consumer after Dmitry Vyukov's bounded MPMC queue: each cell carries a sequence
+// number that tells producers and consumers whose turn it is, so a push or pop is one
+// CAS on the shared index plus a store on the cell.
+//
+// SpscRing, between the client's render and network threads, takes exactly one producer
+// and one consumer thread and needs no CAS: each side owns one index and caches its last
+// look at the other's, so most operations never read the other side's cache line.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace tron_queue {
+
+template <typename T>
+class MpmcQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit MpmcQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_push(const T& value) {
+        return try_push_with([&](T& slot) { slot = value; });
+    }
+
+    // Fill the claimed slot in place with fill(T&), avoiding a copy of large entries
+    template <typename Fill>
+    bool try_push_with(Fill fill) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    fill(cell.value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // Empty
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<size_t> head{0};
+};
+
+template <typename T>
+class SpscRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        slots.reset(new T[size]);
+    }
+
+    // Producer thread only
+    bool try_push(T value) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        if (pos - head_seen > mask) {
+            head_seen = head.load(std::memory_order_acquire);
+            if (pos - head_seen > mask) {
+                return false; // Full
+            }
+        }
+        slots[pos & mask] = std::move(value);
+        tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only
+    bool try_pop(T& value) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        if (pos == tail_seen) {
+            tail_seen = tail.load(std::memory_order_acquire);
+            if (pos == tail_seen) {
+                return false; // Empty
+            }
+        }
+        value = std::move(slots[pos & mask]);
+        head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::unique_ptr<T[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> tail{0};
+    size_t head_seen = 0; // Producer's copy of head
+    alignas(64) std::atomic<size_t> head{0};
+    size_t tail_seen = 0; // Consumer's copy of tail
+};
+
+} // namespace tron_queue
+
+#endif // TRON_QUEUE_HPP
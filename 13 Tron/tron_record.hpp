@@ -0,0 +1,382 @@
+#ifndef TRON_RECORD_HPP
+#define TRON_RECORD_HPP
+
+// Match recordings for tron_server and tron_replay.
+//
+// Every online match can be written to its own append-only file:
+//   [file header, 32 bytes]
+//   [record]...            one TICK record per simulated tick, then one END record
+//   [index][trailer]       written when the match ends
+//
+// All integers are little-endian.
+//   File header: "TRONREC1", u16 width, u16 height, u16 tick ms, u8 players, u8 0,
+//                room id (8 bytes, zero padded), u64 start time (Unix ms)
+//   Record:      u8 type, u32 tick, u32 payload length, payload
+//     TICK:      one byte per player with the direction it turned to this tick
+//                (NO_INPUT if it kept going), then the tron_protocol frame of the tick,
+//                a keyframe every tron_protocol::KEYFRAME_INTERVAL ticks, a delta otherwise
+//     END:       the result text
+//   Index:       per keyframe tick: u32 tick, u64 offset of its TICK record
+//   Trailer:     u64 index offset, u32 entry count, "TRONIDX1"
+//
+// A reader maps the file, binary searches the index for the last keyframe at or before
+// a tick and applies the deltas from there, so a seek touches at most one keyframe
+// interval. Files cut short by a crash have no trailer; scan_index rebuilds the index.
+//
+// The simulation never writes to disk itself: Recording::append_tick only appends to
+// an in-memory batch, and the Recorder's thread writes every batch out in one call.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace tron_record {
+
+const char FILE_MAGIC[8] = {'T', 'R', 'O', 'N', 'R', 'E', 'C', '1'};
+const char INDEX_MAGIC[8] = {'T', 'R', 'O', 'N', 'I', 'D', 'X', '1'};
+const size_t FILE_HEADER_SIZE = 32;
+const size_t RECORD_HEADER_SIZE = 9;
+const size_t INDEX_ENTRY_SIZE = 12;
+const size_t TRAILER_SIZE = 20;
+const uint8_t NO_INPUT = 0xFF;
+
+enum RecordType : uint8_t {
+    RECORD_TICK = 1,
+    RECORD_END = 2
+};
+
+struct FileHeader {
+    int width = 0, height = 0;
+    int tick_ms = 0;
+    int players = 0;
+    std::string room_id;
+    uint64_t start_ms = 0;
+};
+
+struct IndexEntry {
+    uint32_t tick;
+    uint64_t offset;
+};
+
+inline void put_u16(std::string& out, uint16_t v) {
+    out.push_back(static_cast<char>(v & 0xFF));
+    out.push_back(static_cast<char>(v >> 8));
+}
+
+inline void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+}
+
+inline void put_u64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+}
+
+inline uint64_t get_le(const uint8_t* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+inline std::string encode_file_header(const FileHeader& header) {
+    std::string out(FILE_MAGIC, sizeof(FILE_MAGIC));
+    put_u16(out, static_cast<uint16_t>(header.width));
+    put_u16(out, static_cast<uint16_t>(header.height));
+    put_u16(out, static_cast<uint16_t>(header.tick_ms));
+    out.push_back(static_cast<char>(header.players));
+    out.push_back('\0');
+    std::string room = header.room_id.substr(0, 8);
+    room.resize(8, '\0');
+    out += room;
+    put_u64(out, header.start_ms);
+    return out;
+}
+
+inline bool decode_file_header(const uint8_t* data, size_t size, FileHeader& header) {
+    if (size < FILE_HEADER_SIZE || std::memcmp(data, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+        return false;
+    }
+    header.width = static_cast<int>(get_le(data + 8, 2));
+    header.height = static_cast<int>(get_le(data + 10, 2));
+    header.tick_ms = static_cast<int>(get_le(data + 12, 2));
+    header.players = data[14];
+    header.room_id.assign(reinterpret_cast<const char*>(data + 16), 8);
+    header.room_id.resize(std::strlen(header.room_id.c_str()));
+    header.start_ms = get_le(data + 24, 8);
+    return true;
+}
+
+// A record in a mapped file
+struct RecordView {
+    RecordType type;
+    uint32_t tick;
+    const uint8_t* payload;
+    size_t length;
+};
+
+// Read the record at offset, false if it is cut short
+inline bool read_record(const uint8_t* data, size_t size, uint64_t offset, RecordView& record) {
+    if (offset + RECORD_HEADER_SIZE > size) {
+        return false;
+    }
+    const uint8_t* p = data + offset;
+    record.type = static_cast<RecordType>(p[0]);
+    record.tick = static_cast<uint32_t>(get_le(p + 1, 4));
+    record.length = static_cast<size_t>(get_le(p + 5, 4));
+    record.payload = p + RECORD_HEADER_SIZE;
+    return record.length <= size - offset - RECORD_HEADER_SIZE;
+}
+
+// The index written at the end of the file; false if the file has no valid trailer
+inline bool read_index(const uint8_t* data, size_t size, std::vector<IndexEntry>& index, uint64_t& records_end) {
+    if (size < FILE_HEADER_SIZE + TRAILER_SIZE) {
+        return false;
+    }
+    const uint8_t* trailer = data + size - TRAILER_SIZE;
+    if (std::memcmp(trailer + 12, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+        return false;
+    }
+    uint64_t index_offset = get_le(trailer, 8);
+    uint64_t count = get_le(trailer + 8, 4);
+    if (index_offset < FILE_HEADER_SIZE || index_offset + count * INDEX_ENTRY_SIZE != size - TRAILER_SIZE) {
+        return false;
+    }
+    index.resize(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        const uint8_t* entry = data + index_offset + i * INDEX_ENTRY_SIZE;
+        index[i].tick = static_cast<uint32_t>(get_le(entry, 4));
+        index[i].offset = get_le(entry + 4, 8);
+    }
+    records_end = index_offset;
+    return true;
+}
+
+// Rebuild the index of a file without trailer by walking its records. is_keyframe
+// tells whether a TICK payload holds a keyframe.
+template <typename IsKeyframe>
+void scan_index(const uint8_t* data, size_t size, int players, IsKeyframe is_keyframe,
+                std::vector<IndexEntry>& index, uint64_t& records_end) {
+    index.clear();
+    uint64_t offset = FILE_HEADER_SIZE;
+    RecordView record;
+    while (read_record(data, size, offset, record) && (record.type == RECORD_TICK || record.type == RECORD_END)) {
+        if (record.type == RECORD_TICK && record.length > static_cast<size_t>(players) &&
+            is_keyframe(record.payload + players, record.length - players)) {
+            index.push_back(IndexEntry{record.tick, offset});
+        }
+        offset += RECORD_HEADER_SIZE + record.length;
+    }
+    records_end = offset;
+}
+
+// Last index entry at or before tick, or nullptr if tick comes before the first keyframe
+inline const IndexEntry* find_keyframe(const std::vector<IndexEntry>& index, uint32_t tick) {
+    auto it = std::upper_bound(index.begin(), index.end(), tick,
+                               [](uint32_t t, const IndexEntry& entry) { return t < entry.tick; });
+    return it == index.begin() ? nullptr : &*(it - 1);
+}
+
+// One match being recorded. append_tick and finish are called from the room strand;
+// the Recorder's thread takes the pending bytes and writes them.
+class Recording {
+public:
+    Recording(const std::string& path, const FileHeader& header)
+        : path(path), pending(encode_file_header(header)), offset(FILE_HEADER_SIZE) {}
+
+    ~Recording() {
+        if (file) {
+            std::fclose(file);
+        }
+    }
+
+    void append_tick(uint32_t tick, const std::vector<uint8_t>& inputs, const std::string& frame, bool keyframe) {
+        if (keyframe) {
+            index.push_back(IndexEntry{tick, offset});
+        }
+        std::string record;
+        record.reserve(RECORD_HEADER_SIZE + inputs.size() + frame.size());
+        record.push_back(static_cast<char>(RECORD_TICK));
+        put_u32(record, tick);
+        put_u32(record, static_cast<uint32_t>(inputs.size() + frame.size()));
+        record.append(inputs.begin(), inputs.end());
+        record += frame;
+        append(record);
+    }
+
+    // Close the log with the result and the keyframe index
+    void finish(uint32_t tick, const std::string& result) {
+        std::string tail;
+        tail.push_back(static_cast<char>(RECORD_END));
+        put_u32(tail, tick);
+        put_u32(tail, static_cast<uint32_t>(result.size()));
+        tail += result;
+
+        uint64_t index_offset = offset + tail.size();
+        for (const IndexEntry& entry : index) {
+            put_u32(tail, entry.tick);
+            put_u64(tail, entry.offset);
+        }
+        put_u64(tail, index_offset);
+        put_u32(tail, static_cast<uint32_t>(index.size()));
+        tail.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        append(tail);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+
+    const std::string& file_path() const {
+        return path;
+    }
+
+private:
+    friend class Recorder;
+
+    void append(const std::string& bytes) {
+        offset += bytes.size();
+        std::lock_guard<std::mutex> lock(mutex);
+        pending += bytes;
+    }
+
+    std::string path;
+
+    // Shared with the writer thread
+    std::mutex mutex;
+    std::string pending;
+    bool finished = false;
+
+    // Room strand only
+    uint64_t offset;
+    std::vector<IndexEntry> index;
+
+    // Writer thread only
+    std::FILE* file = nullptr;
+    bool failed = false;
+};
+
+// Background writer for all recordings. Every flush interval it swaps out the bytes
+// each recording gathered since the last pass and writes them with one fwrite per file.
+class Recorder {
+public:
+    ~Recorder() {
+        stop();
+    }
+
+    void start(const std::string& directory, int flush_ms = 100) {
+        dir = directory;
+        interval = std::chrono::milliseconds(std::max(1, flush_ms));
+        if (!running.exchange(true)) {
+            writer = std::thread(&Recorder::run, this);
+        }
+    }
+
+    // Writes out everything pending, including unfinished recordings, and stops the writer
+    void stop() {
+        if (running.exchange(false)) {
+            writer.join();
+        }
+    }
+
+    bool enabled() const {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<Recording> create(const FileHeader& header) {
+        std::string path = dir + "/" + header.room_id + "-" + std::to_string(header.start_ms) + ".tronrec";
+        auto recording = std::make_shared<Recording>(path, header);
+        std::lock_guard<std::mutex> lock(mutex);
+        recordings.push_back(recording);
+        return recording;
+    }
+
+    uint64_t bytes_written() const {
+        return written.load(std::memory_order_relaxed);
+    }
+
+    uint64_t errors() const {
+        return failures.load(std::memory_order_relaxed);
+    }
+
+private:
+    void run() {
+        for (;;) {
+            bool stopping = !running.load(std::memory_order_acquire);
+            flush();
+            if (stopping) {
+                return;
+            }
+            std::this_thread::sleep_for(interval);
+        }
+    }
+
+    void flush() {
+        std::vector<std::shared_ptr<Recording>> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch = recordings;
+        }
+
+        std::string bytes;
+        for (const std::shared_ptr<Recording>& recording : batch) {
+            bool done;
+            bytes.clear();
+            {
+                std::lock_guard<std::mutex> lock(recording->mutex);
+                bytes.swap(recording->pending);
+                done = recording->finished;
+            }
+            write(*recording, bytes);
+            if (done && recording->file) {
+                std::fclose(recording->file);
+                recording->file = nullptr;
+            }
+            if (done) {
+                std::lock_guard<std::mutex> lock(mutex);
+                recordings.erase(std::remove(recordings.begin(), recordings.end(), recording), recordings.end());
+            }
+        }
+    }
+
+    void write(Recording& recording, const std::string& bytes) {
+        if (bytes.empty() || recording.failed) {
+            return;
+        }
+        if (!recording.file) {
+            recording.file = std::fopen(recording.path.c_str(), "wb");
+        }
+        if (!recording.file || std::fwrite(bytes.data(), 1, bytes.size(), recording.file) != bytes.size() ||
+            std::fflush(recording.file) != 0) {
+            recording.failed = true; // Keep the server going, the file is lost
+            failures.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        written.fetch_add(bytes.size(), std::memory_order_relaxed);
+    }
+
+    std::string dir;
+    std::chrono::milliseconds interval{100};
+    std::thread writer;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> failures{0};
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Recording>> recordings;
+};
+
+} // namespace tron_record
+
+#endif // TRON_RECORD_HPP
@@ -0,0 +1,167 @@
+#ifndef TRON_REGISTRY_HPP
+#define TRON_REGISTRY_HPP
+
+// Room and connection registry for tron_server.
+//
+// Connections get a stable integer id when they open, and rooms are indexed by their
+// 6-character id packed into a 32-bit integer, so every lookup is a hash of an
+// integer. The tables are split into independently locked shards so that the server's
+// thread pool only contends when two handlers hit the same shard.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace tron_registry {
+
+typedef uint64_t conn_id;   // 0 is never handed out
+typedef uint32_t room_key;  // Base-36 packed room id, 36^6 < 2^32
+
+const room_key NO_ROOM = 0xFFFFFFFFu;
+const int ROOM_ID_LENGTH = 6;
+const room_key ROOM_KEY_COUNT = 2176782336u; // 36^6
+
+inline int room_char_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+    return -1;
+}
+
+// Pack a room id typed by a player (case-insensitive). Returns false if it is malformed.
+inline bool pack_room_id(const std::string& id, room_key& key) {
+    if (id.size() != ROOM_ID_LENGTH) {
+        return false;
+    }
+    uint32_t value = 0;
+    for (char c : id) {
+        int digit = room_char_value(c);
+        if (digit < 0) {
+            return false;
+        }
+        value = value * 36 + static_cast<uint32_t>(digit);
+    }
+    key = value;
+    return true;
+}
+
+inline std::string unpack_room_id(room_key key) {
+    static const char chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    std::string id(ROOM_ID_LENGTH, '0');
+    for (int i = ROOM_ID_LENGTH - 1; i >= 0; --i) {
+        id[i] = chars[key % 36];
+        key /= 36;
+    }
+    return id;
+}
+
+// Worker process owning a key when tron_router spreads rooms over shards processes:
+// workers only hand out room keys and resume tokens that map to themselves, so the
+// router finds the owner of a room id or token without asking anyone.
+inline int shard_of(uint64_t key, int shards) {
+    if (shards <= 1) {
+        return 0;
+    }
+    return static_cast<int>(((key * 0x9E3779B97F4A7C15ull) >> 32) % static_cast<uint64_t>(shards));
+}
+
+// Hands out connection ids, unique for the lifetime of the process
+class ConnectionIds {
+public:
+    conn_id next() {
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+private:
+    std::atomic<conn_id> counter{0};
+};
+
+// Hash table over integer keys split into independently locked shards
+template <typename Key, typename Value, size_t SHARDS = 64>
+class ShardedTable {
+public:
+    // Returns false if the key is already present
+    bool insert(Key key, const Value& value) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (!shard.map.emplace(key, value).second) {
+            return false;
+        }
+        count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool find(Key key, Value& value) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    // Calls f(value) under the shard lock and returns its result, or false if the key is absent
+    template <typename F>
+    bool modify(Key key, F f) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.map.find(key);
+        return it != shard.map.end() && f(it->second);
+    }
+
+    bool erase(Key key, Value* erased = nullptr) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return false;
+        }
+        if (erased) {
+            *erased = it->second;
+        }
+        shard.map.erase(it);
+        count.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Approximate while other threads are inserting or erasing
+    size_t size() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    // Visit every entry, one shard lock at a time. f must not call back into the table.
+    template <typename F>
+    void for_each(F f) {
+        for (Shard& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            for (auto& entry : shard.map) {
+                f(entry.first, entry.second);
+            }
+        }
+    }
+
+private:
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<Key, Value> map;
+    };
+
+    // Fibonacci hashing spreads sequential connection ids evenly over the shards
+    Shard& shard_for(Key key) {
+        return shards[((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> 58) & (SHARDS - 1)];
+    }
+
+    static_assert((SHARDS & (SHARDS - 1)) == 0 && SHARDS <= 64, "SHARDS must be a power of two up to 64");
+
+    Shard shards[SHARDS];
+    std::atomic<size_t> count{0};
+};
+
+} // namespace tron_registry
+
+#endif // TRON_REGISTRY_HPP
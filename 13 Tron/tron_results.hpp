@@ -0,0 +1,281 @@
+#ifndef TRON_RESULTS_HPP
+#define TRON_RESULTS_HPP
+
+// Results of finished online matches, kept in SQLite (tron_server --results-db).
+//
+// Room strands never touch the database: end_match() pushes a MatchResult onto a
+// lock-free queue and carries on. One writer thread owns the connection, drains the
+// queue every flush interval and inserts everything it found in one transaction, with
+// the database in WAL mode so a commit is a single append to the log. RESULTS queries
+// go through the same queue and run on the writer thread after the pending inserts,
+// so they see every match that ended before them.
+//
+// A pass whose transaction cannot begin or commit, with another tron_server holding the
+// database past the busy timeout, keeps its rows and tries them again with the next
+// pass. Rows still unwritten after MAX_ATTEMPTS passes are dropped and counted, as
+// results that find the queue full are.
+//
+// Table: matches(id, room, finished_ms, duration_ms, ticks, players, bots, winner,
+// result, lineup), indexed on finished_ms for the most-recent-first query.
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tron_queue.hpp"
+
+namespace tron_results {
+
+struct MatchResult {
+    std::string room_id;
+    int64_t finished_ms = 0; // Unix time
+    int64_t duration_ms = 0;
+    uint32_t ticks = 0;
+    int players = 0;
+    int bots = 0;
+    int winner = -1;         // Slot, -1 for a draw
+    std::string result;      // As sent in GAME_OVER
+    std::string lineup;      // Connection id per slot, "bot" for bots, comma separated
+};
+
+class ResultStore {
+public:
+    explicit ResultStore(size_t capacity = 4096) : jobs(capacity) {}
+
+    ~ResultStore() {
+        stop();
+    }
+
+    // Opens or creates the database. Returns false, with the reason in error, if it cannot.
+    bool start(const std::string& path, std::string& error, int flush_ms = 200) {
+        if (running.load()) {
+            return true;
+        }
+        if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+            error = sqlite3_errmsg(db);
+            sqlite3_close(db);
+            db = nullptr;
+            return false;
+        }
+        sqlite3_busy_timeout(db, 1000); // Workers of a tron_router may share the file
+        const char* schema =
+            "PRAGMA journal_mode=WAL;"
+            "PRAGMA synchronous=NORMAL;"
+            "CREATE TABLE IF NOT EXISTS matches ("
+            " id INTEGER PRIMARY KEY,"
+            " room TEXT NOT NULL,"
+            " finished_ms INTEGER NOT NULL,"
+            " duration_ms INTEGER NOT NULL,"
+            " ticks INTEGER NOT NULL,"
+            " players INTEGER NOT NULL,"
+            " bots INTEGER NOT NULL,"
+            " winner INTEGER NOT NULL,"
+            " result TEXT NOT NULL,"
+            " lineup TEXT NOT NULL);"
+            "CREATE INDEX IF NOT EXISTS matches_finished ON matches(finished_ms);";
+        char* message = nullptr;
+        if (sqlite3_exec(db, schema, nullptr, nullptr, &message) != SQLITE_OK ||
+            sqlite3_prepare_v2(db, "INSERT INTO matches (room, finished_ms, duration_ms, ticks, players, bots, winner, result, lineup)"
+                                   " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", -1, &insert, nullptr) != SQLITE_OK ||
+            sqlite3_prepare_v2(db, "SELECT room, finished_ms, duration_ms, ticks, players, bots, winner, result FROM matches"
+                                   " ORDER BY finished_ms DESC LIMIT ?", -1, &recent, nullptr) != SQLITE_OK) {
+            error = message ? message : sqlite3_errmsg(db);
+            sqlite3_free(message);
+            close();
+            return false;
+        }
+        interval = std::chrono::milliseconds(std::max(1, flush_ms));
+        running.store(true);
+        writer = std::thread(&ResultStore::run, this);
+        return true;
+    }
+
+    // Writes out the queued results and closes the database
+    void stop() {
+        if (running.exchange(false)) {
+            writer.join();
+        }
+        close();
+    }
+
+    bool enabled() const {
+        return running.load(std::memory_order_relaxed);
+    }
+
+    // Never blocks; a result that finds the queue full is dropped and counted
+    bool submit(MatchResult result) {
+        if (!enabled()) {
+            return false;
+        }
+        if (!jobs.try_push_with([&](Job& job) { job = Job(); job.result = std::move(result); })) {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // The most recent limit results as a RESULTS reply, handed to reply on the writer thread:
+    // RESULTS <count>, then "<room> <finished_ms> <duration_ms> <ticks> <players> <bots> <winner> <result>"
+    // per match, newest first. Returns false if the queue is full.
+    bool query_recent(int limit, std::function<void(const std::string&)> reply) {
+        return enabled() && jobs.try_push_with([&](Job& job) {
+            job = Job();
+            job.limit = limit;
+            job.reply = std::move(reply);
+        });
+    }
+
+    uint64_t written() const {
+        return written_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() const {
+        return dropped_count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t errors() const {
+        return error_count.load(std::memory_order_relaxed);
+    }
+
+private:
+    // An insert, or a query when reply is set
+    struct Job {
+        MatchResult result;
+        int limit = 0;
+        std::function<void(const std::string&)> reply;
+    };
+
+    static const int MAX_ATTEMPTS = 5;
+
+    void run() {
+        for (;;) {
+            bool stopping = !running.load(std::memory_order_acquire);
+            flush();
+            if (stopping) {
+                dropped_count.fetch_add(batch.size(), std::memory_order_relaxed);
+                batch.clear();
+                return;
+            }
+            std::this_thread::sleep_for(interval);
+        }
+    }
+
+    // One transaction for all inserts queued since the last pass and those a failed pass
+    // left behind, then the queries
+    void flush() {
+        std::vector<Job> queries;
+        Job job;
+        while (jobs.try_pop(job)) {
+            if (job.reply) {
+                queries.push_back(std::move(job));
+            } else {
+                batch.push_back(std::move(job.result));
+            }
+        }
+        if (!batch.empty()) {
+            write_batch();
+        }
+        for (Job& query : queries) {
+            query.reply(select_recent(query.limit));
+        }
+    }
+
+    // Clears the batch once it is committed or has used up its attempts
+    void write_batch() {
+        bool committed = false;
+        if (sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr) == SQLITE_OK) {
+            // A row the insert itself rejects would fail again, it is dropped rather than kept
+            std::vector<MatchResult> stored;
+            stored.reserve(batch.size());
+            for (MatchResult& result : batch) {
+                if (store(result)) {
+                    stored.push_back(std::move(result));
+                } else {
+                    dropped_count.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            batch.swap(stored);
+            committed = sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+            if (!committed) {
+                sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+            }
+        }
+        if (committed) {
+            written_count.fetch_add(batch.size(), std::memory_order_relaxed);
+        } else {
+            error_count.fetch_add(1, std::memory_order_relaxed);
+            if (++failed_attempts < MAX_ATTEMPTS) {
+                return;
+            }
+            dropped_count.fetch_add(batch.size(), std::memory_order_relaxed);
+        }
+        batch.clear();
+        failed_attempts = 0;
+    }
+
+    bool store(const MatchResult& r) {
+        sqlite3_bind_text(insert, 1, r.room_id.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(insert, 2, r.finished_ms);
+        sqlite3_bind_int64(insert, 3, r.duration_ms);
+        sqlite3_bind_int64(insert, 4, r.ticks);
+        sqlite3_bind_int(insert, 5, r.players);
+        sqlite3_bind_int(insert, 6, r.bots);
+        sqlite3_bind_int(insert, 7, r.winner);
+        sqlite3_bind_text(insert, 8, r.result.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(insert, 9, r.lineup.c_str(), -1, SQLITE_TRANSIENT);
+        bool done = sqlite3_step(insert) == SQLITE_DONE;
+        if (!done) {
+            error_count.fetch_add(1, std::memory_order_relaxed);
+        }
+        sqlite3_reset(insert);
+        return done;
+    }
+
+    std::string select_recent(int limit) {
+        std::string rows;
+        int count = 0;
+        sqlite3_bind_int(recent, 1, limit);
+        while (sqlite3_step(recent) == SQLITE_ROW) {
+            rows += "\n";
+            for (int column = 0; column < 8; ++column) {
+                const unsigned char* text = sqlite3_column_text(recent, column);
+                rows += (column ? " " : "") + std::string(text ? reinterpret_cast<const char*>(text) : "");
+            }
+            ++count;
+        }
+        sqlite3_reset(recent);
+        return "RESULTS " + std::to_string(count) + rows;
+    }
+
+    void close() {
+        sqlite3_finalize(insert);
+        sqlite3_finalize(recent);
+        insert = recent = nullptr;
+        sqlite3_close(db);
+        db = nullptr;
+    }
+
+    tron_queue::MpmcQueue<Job> jobs;
+    std::thread writer;
+    std::atomic<bool> running{false};
+    std::chrono::milliseconds interval{200};
+    std::atomic<uint64_t> written_count{0}, dropped_count{0}, error_count{0};
+
+    // Writer thread only, once started
+    std::vector<MatchResult> batch; // Rows of the current pass, and of failed ones still to retry
+    int failed_attempts = 0;        // Passes in a row the batch failed to commit
+    sqlite3* db = nullptr;
+    sqlite3_stmt* insert = nullptr;
+    sqlite3_stmt* recent = nullptr;
+};
+
+} // namespace tron_results
+
+#endif // TRON_RESULTS_HPP
@@ -0,0 +1,114 @@
+#ifndef TRON_TIMER_HPP
+#define TRON_TIMER_HPP
+
+// Hierarchical timer wheel for timeouts on many objects at once (Varghese and Lauck).
+//
+// Time advances in whole ticks. Level 0 has one slot per tick for the next 64 ticks,
+// level 1 one slot per 64 ticks for the next 64^2, and so on over LEVELS levels. An
+// entry goes into the coarsest level its deadline needs, and whenever a finer level
+// wraps around, the next slot of the level above is emptied into the finer levels. So
+// scheduling is O(1), and every entry moves down at most LEVELS - 1 times before it fires.
+// Deadlines past the last level wait in its farthest slot and are placed again from there.
+//
+// Not thread-safe: one thread schedules and advances.
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace tron_timer {
+
+template <typename T>
+class TimerWheel {
+public:
+    explicit TimerWheel(uint64_t now = 0) : current(now) {}
+
+    // Fire value at tick deadline, or on the next tick if that has passed
+    void schedule(uint64_t deadline, T value) {
+        place(Entry{deadline > current ? deadline : current + 1, std::move(value)});
+        ++count;
+    }
+
+    // Run the clock up to now, calling fire(value) for each entry that comes due, in
+    // deadline order. fire returns the tick to fire the entry again at, or 0 to forget it.
+    template <typename Fire>
+    void advance(uint64_t now, Fire fire) {
+        while (current < now) {
+            ++current;
+            for (int level = 1; level < LEVELS && (current & ((uint64_t(1) << (BITS * level)) - 1)) == 0; ++level) {
+                cascade(level);
+            }
+            std::vector<Entry>& due = slots[0][current & MASK];
+            if (due.empty()) {
+                continue;
+            }
+            firing.swap(due);
+            for (Entry& entry : firing) {
+                --count;
+                uint64_t again = fire(entry.value);
+                if (again != 0) {
+                    schedule(again, std::move(entry.value));
+                }
+            }
+            firing.clear();
+        }
+    }
+
+    uint64_t now() const {
+        return current;
+    }
+
+    // Entries waiting to fire
+    size_t size() const {
+        return count;
+    }
+
+private:
+    static const int BITS = 6;
+    static const int LEVELS = 4;
+    static const uint64_t SLOTS = uint64_t(1) << BITS;
+    static const uint64_t MASK = SLOTS - 1;
+
+    struct Entry {
+        uint64_t deadline;
+        T value;
+    };
+
+    void place(Entry entry) {
+        uint64_t delta = entry.deadline - current;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (uint64_t(1) << (BITS * (level + 1)))) {
+            ++level;
+        }
+        uint64_t slot;
+        if (delta >= (uint64_t(1) << (BITS * LEVELS))) {
+            slot = (current >> (BITS * level)) & MASK; // Its next turn is the farthest away
+        } else {
+            slot = (entry.deadline >> (BITS * level)) & MASK;
+        }
+        slots[level][slot].push_back(std::move(entry));
+    }
+
+    // Move the level's current slot down, now that the finer levels have come round to it
+    void cascade(int level) {
+        std::vector<Entry>& slot = slots[level][(current >> (BITS * level)) & MASK];
+        if (slot.empty()) {
+            return;
+        }
+        std::vector<Entry> moving;
+        moving.swap(slot);
+        for (Entry& entry : moving) {
+            place(std::move(entry));
+        }
+    }
+
+    uint64_t current;
+    size_t count = 0;
+    std::vector<Entry> slots[LEVELS][SLOTS];
+    std::vector<Entry> firing; // Reused by advance so that a busy slot keeps its capacity
+};
+
+} // namespace tron_timer
+
+#endif // TRON_TIMER_HPP